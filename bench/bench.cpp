@@ -0,0 +1,470 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../src/eko.hpp"
+#include "../src/utils/optimizer.hpp"
+#include "../src/utils/generator.hpp"
+#include "../src/utils/gvn.hpp"
+#include "../src/utils/irgen.hpp"
+#include "../src/utils/peephole.hpp"
+#include "../src/utils/encoder.hpp"
+#include "../src/utils/elf.hpp"
+#include "../src/utils/jit.hpp"
+
+#ifndef EKO_VERSION
+#define EKO_VERSION "dev"
+#endif
+
+using namespace std;
+
+// Deterministic generator of large eko programs. Every corpus only divides by non zero literals,
+// declares each name once and only reads names that are visible, so all of them compile and run.
+class CorpusGenerator {
+    public:
+        inline explicit CorpusGenerator(uint64_t seed): _state(seed) { }
+
+        // Long straight line of lets and assignments over the previous variables.
+        string lets(size_t count) {
+            begin();
+            for(size_t i = 0; i < count; i++) {
+                if(i % 4 == 3) assignment("");
+                else let("");
+            }
+            return finish();
+        }
+
+        // Expressions nested `depth` parentheses deep, alternating left and right leaning.
+        string nesting(size_t count, size_t depth) {
+            begin();
+            for(size_t i = 0; i < count; i++) {
+                string name = fresh();
+                _out += "let " + name + " = " + nested(depth, i % 2 == 0) + "\n";
+                _visible.push_back(name);
+            }
+            return finish();
+        }
+
+        // Nested scopes and if/else chains up to `depth` levels deep.
+        string scopes(size_t count, size_t depth) {
+            begin();
+            for(size_t i = 0; i < count; i++) block(depth, "");
+            return finish();
+        }
+
+        // Mostly comments, with a let every few lines.
+        string comments(size_t count) {
+            begin();
+            for(size_t i = 0; i < count; i++) {
+                switch(next(4)) {
+                    case 0: _out += "// line comment " + to_string(next(1000000)) + " with some text to skip over\n"; break;
+                    case 1: _out += "/* block comment\n   spanning lines " + to_string(next(1000)) + "\n*/\n"; break;
+                    case 2: _out += "/* inline */ "; let(""); break;
+                    default: let(""); _out.back() = ' '; _out += "// trailing comment\n"; break;
+                }
+            }
+            return finish();
+        }
+
+        // Counted while loops, nested up to `depth` deep, that keep updating the variables declared before them.
+        string loops(size_t count, size_t depth) {
+            begin();
+            for(size_t i = 0; i < count; i++) {
+                let("");
+                loop(depth, "");
+            }
+            return finish();
+        }
+
+    private:
+        uint64_t _state;
+        string _out {};
+        vector<string> _visible {};
+        size_t _names = 0;
+
+        // splitmix64, fixed across platforms unlike the standard distributions
+        uint64_t next(uint64_t bound) {
+            uint64_t z = (_state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return (z ^ (z >> 31)) % bound;
+        }
+
+        void begin() {
+            _out.clear();
+            _visible.clear();
+            _names = 0;
+        }
+
+        string finish() {
+            _out += "exit(" + expression(2) + ")\n";
+            return move(_out);
+        }
+
+        string fresh() {
+            string name = "v"; // `"v" + to_string(...)` trips a GCC 12 -Wrestrict false positive
+            name += to_string(_names++);
+            return name;
+        }
+
+        string atom() {
+            if(!_visible.empty() && next(3) != 0) return _visible[_visible.size() - 1 - next(min<size_t>(_visible.size(), 16))];
+            return to_string(next(1000));
+        }
+
+        string expression(size_t depth) {
+            if(depth == 0 || next(3) == 0) return atom();
+            switch(next(5)) {
+                case 0: return expression(depth - 1) + " + " + expression(depth - 1);
+                case 1: return expression(depth - 1) + " - " + expression(depth - 1);
+                case 2: return expression(depth - 1) + " * " + expression(depth - 1);
+                case 3: return "(" + expression(depth - 1) + ") / " + to_string(next(97) + 1);
+                default: return "(" + expression(depth - 1) + " + " + expression(depth - 1) + ")";
+            }
+        }
+
+        string nested(size_t depth, bool leftLeaning) {
+            static const char* operators[] = { " + ", " - ", " * " };
+            string expression = atom();
+            for(size_t i = 0; i < depth; i++) {
+                string op = operators[next(3)];
+                expression = leftLeaning ? "(" + expression + op + atom() + ")" : "(" + atom() + op + expression + ")";
+            }
+            return expression;
+        }
+
+        void let(const string& indent) {
+            string name = fresh();
+            _out += indent + "let " + name + " = " + expression(3) + "\n";
+            _visible.push_back(name);
+        }
+
+        void assignment(const string& indent) {
+            if(_visible.empty()) return let(indent);
+            _out += indent + _visible[next(_visible.size())] + " = " + expression(3) + "\n";
+        }
+
+        // The counter only becomes visible after the loop, so nothing inside it can keep the loop from ending.
+        void loop(size_t depth, const string& indent) {
+            string counter = fresh();
+            _out += indent + "let " + counter + " = " + to_string(next(20) + 1) + "\n";
+            _out += indent + "while(" + counter + ") {\n";
+            size_t visible = _visible.size();
+            for(size_t i = next(3) + 1; i > 0; i--) {
+                if(depth > 0 && next(3) == 0) loop(depth - 1, indent + "    ");
+                else assignment(indent + "    ");
+            }
+            _visible.resize(visible);
+            _out += indent + "    " + counter + " = " + counter + " - 1\n" + indent + "}\n";
+            _visible.push_back(counter);
+        }
+
+        void block(size_t depth, const string& indent) {
+            size_t kind = depth == 0 ? 0 : next(4);
+            if(kind <= 1) {
+                if(kind == 0) let(indent);
+                else assignment(indent);
+                return;
+            }
+            size_t visible = _visible.size();
+            if(kind == 2) {
+                _out += indent + "{\n";
+                for(size_t i = next(4) + 1; i > 0; i--) block(depth - 1, indent + "    ");
+                _out += indent + "}\n";
+            } else {
+                _out += indent + "if(" + expression(2) + ") {\n";
+                for(size_t i = next(4) + 1; i > 0; i--) block(depth - 1, indent + "    ");
+                _visible.resize(visible);
+                _out += indent + "}";
+                if(next(2) == 0) {
+                    _out += " else {\n";
+                    for(size_t i = next(3) + 1; i > 0; i--) block(depth - 1, indent + "    ");
+                    _out += indent + "}";
+                }
+                _out += "\n";
+            }
+            _visible.resize(visible); // names declared inside the scope are gone
+        }
+};
+
+struct Corpus {
+    string name;
+    string source;
+};
+
+struct Result {
+    string name;
+    size_t bytes;
+    double median;
+    double minimum;
+};
+
+// Times `body` a fixed number of times and keeps the median and the fastest run.
+static Result measure(const string& name, size_t bytes, size_t iterations, const function<void()>& body) {
+    vector<double> samples;
+    for(size_t i = 0; i < iterations; i++) {
+        auto start = chrono::steady_clock::now();
+        body();
+        chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+        samples.push_back(elapsed.count());
+    }
+    sort(samples.begin(), samples.end());
+    return { .name = name, .bytes = bytes, .median = samples[samples.size() / 2], .minimum = samples.front() };
+}
+
+static int runExecutable(const filesystem::path& path) {
+    pid_t pid = fork();
+    if(pid == 0) {
+        execl(path.c_str(), path.c_str(), nullptr);
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// The output of every stage of the pipeline for one corpus.
+struct Pipeline {
+    size_t tokens = 0;
+    NodeProgram tree;
+    NodeProgram program;
+    vector<Instruction> instructions;
+    vector<uint8_t> code;
+    size_t entry = 0;
+};
+
+static Pipeline build(const string& source, Target target) {
+    Pipeline pipeline;
+    Tokenizer tokenizer(source);
+    pipeline.tree = Parser(tokenizer).parse().value();
+    pipeline.tokens = tokenizer.count();
+    pipeline.program = Optimizer(pipeline.tree).optimize();
+    pipeline.instructions = Generator(pipeline.program, target).generateProgram();
+    Peephole(pipeline.instructions).run();
+    Encoder encoder(pipeline.instructions);
+    pipeline.code = encoder.encode();
+    pipeline.entry = encoder.labelOffset("_start");
+    return pipeline;
+}
+
+// The code generation behind --ir: lowering to SSA form, value numbering and generating from the IR.
+static vector<Instruction> generateFromIr(const NodeProgram& program, Target target) {
+    IrFunction function = IrBuilder(program).build();
+    ValueNumbering(function).run();
+    return IrGenerator(function, target).generate();
+}
+
+// Compiles and runs `source` in process without the optimizer, so literal operands reach the generator as written.
+static uint64_t runUnoptimized(const string& source) {
+    Tokenizer tokenizer(source);
+    NodeProgram program = Parser(tokenizer).parse().value();
+    vector<Instruction> instructions = Generator(program, Target::FUNCTION).generateProgram();
+    Peephole(instructions).run();
+    Encoder encoder(instructions);
+    vector<uint8_t> code = encoder.encode();
+    return JitFunction(code, encoder.labelOffset("_start")).run();
+}
+
+// The generator strength reduces multiplication and division by literals. For every constant of the sweep this
+// folds the products and quotients of many values into one checksum, computed by the reduced code, by the generic
+// imul and div (the constant read from a variable) and by the host, and reports the constants where they differ.
+static bool verifyStrengthReduction() {
+    uint64_t state = 0x5eed;
+    auto random = [&] {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    };
+    vector<uint64_t> constants;
+    for(uint64_t constant = 0; constant <= 300; constant++) constants.push_back(constant);
+    for(int bit = 9; bit < 64; bit++) {
+        for(int64_t delta : { -1, 0, 1 }) constants.push_back((uint64_t{1} << bit) + delta);
+    }
+    constants.insert(constants.end(), { 641, 1000, 1000000, 6700417, 1000000000000000000, 0x7FFFFFFF, 0xFFFFFFFF80000000, UINT64_MAX - 1, UINT64_MAX });
+    for(int i = 0; i < 64; i++) constants.push_back(i % 2 == 0 ? random() : random() >> (random() % 64));
+
+    size_t checked = 0, failures = 0;
+    for(uint64_t constant : constants) {
+        vector<uint64_t> values = { 0, 1, 2, constant - 1, constant, constant + 1, 2 * constant - 1, 2 * constant, 3 * constant,
+                                    UINT32_MAX, uint64_t{1} << 32, INT64_MAX, uint64_t{1} << 63, UINT64_MAX - 1, UINT64_MAX };
+        for(int i = 0; i < 24; i++) values.push_back(random() >> (random() % 64));
+
+        for(char op : { '*', '/' }) {
+            if(op == '/' && constant == 0) continue;
+            string reduced = "let s = 0\n", generic = "let c = " + to_string(constant) + "\nlet k = 31\nlet s = 0\n";
+            uint64_t expected = 0;
+            for(uint64_t value : values) {
+                string x = to_string(value), c = to_string(constant);
+                if(op == '*') {
+                    reduced += "s = s * 31 + " + x + " * " + c + "\ns = s * 31 + " + c + " * " + x + "\n";
+                    generic += "s = s * k + " + x + " * c\ns = s * k + c * " + x + "\n";
+                    expected = (expected * 31 + value * constant) * 31 + constant * value;
+                } else {
+                    reduced += "s = s * 31 + " + x + " / " + c + "\n";
+                    generic += "s = s * k + " + x + " / c\n";
+                    expected = expected * 31 + value / constant;
+                }
+            }
+            reduced += "exit(s)\n";
+            generic += "exit(s)\n";
+            uint64_t reducedResult = runUnoptimized(reduced), genericResult = runUnoptimized(generic);
+            if(reducedResult != expected || genericResult != expected) {
+                cerr << "Strength reduction mismatch for `x " << op << " " << constant << "`: reduced " << reducedResult
+                     << ", generic " << genericResult << ", expected " << expected << "." << endl;
+                failures++;
+            }
+            checked += values.size();
+        }
+    }
+    cout << "# strength reduction: " << constants.size() << " constants, " << checked << " values, " << failures << " mismatches\n";
+    return failures == 0;
+}
+
+int main(int argc, char* argv[]) {
+    size_t scale = 1;
+    size_t iterations = 5;
+    string filter;
+    optional<filesystem::path> emitDirectory;
+    bool verify = false;
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "--scale" && i + 1 < argc) scale = max<size_t>(1, strtoull(argv[++i], nullptr, 10));
+        else if(arg == "--iterations" && i + 1 < argc) iterations = max<size_t>(1, strtoull(argv[++i], nullptr, 10));
+        else if(arg == "--filter" && i + 1 < argc) filter = argv[++i];
+        else if(arg == "--emit-corpus" && i + 1 < argc) emitDirectory = argv[++i];
+        else if(arg == "--verify") verify = true;
+        else {
+            cerr << "Usage: eko_bench [--scale <n>] [--iterations <n>] [--filter <substring>] [--emit-corpus <dir>] [--verify]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if(verify) return verifyStrengthReduction() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    CorpusGenerator generator(0xe60);
+    vector<Corpus> corpora = {
+        { .name = "lets", .source = generator.lets(20000 * scale) },
+        { .name = "nesting", .source = generator.nesting(400 * scale, 64) },
+        { .name = "scopes", .source = generator.scopes(500 * scale, 6) },
+        { .name = "comments", .source = generator.comments(20000 * scale) },
+        { .name = "loops", .source = generator.loops(2000 * scale, 2) },
+    };
+
+    if(emitDirectory.has_value()) {
+        filesystem::create_directories(*emitDirectory);
+        for(const Corpus& corpus : corpora) ofstream(*emitDirectory / (corpus.name + ".eko")) << corpus.source;
+        return EXIT_SUCCESS;
+    }
+
+    // The header and corpus lines are deterministic, only the timings change between runs.
+    cout << "# eko_bench " << EKO_VERSION << " scale=" << scale << " iterations=" << iterations << " scanner=" << Scanner::implementation() << "\n";
+    cout << left << setw(12) << "# corpus" << right << setw(12) << "bytes" << setw(12) << "tokens" << setw(14) << "instructions" << setw(12) << "exit" << "\n";
+    vector<Pipeline> pipelines;
+    for(const Corpus& corpus : corpora) {
+        pipelines.push_back(build(corpus.source, Target::FUNCTION));
+        const Pipeline& pipeline = pipelines.back();
+        uint64_t exitCode = JitFunction(pipeline.code, pipeline.entry).run();
+        cout << left << setw(12) << corpus.name << right << setw(12) << corpus.source.size() << setw(12) << pipeline.tokens
+             << setw(14) << pipeline.instructions.size() << setw(12) << (exitCode & 0xFF) << "\n";
+    }
+
+    filesystem::path scratch = filesystem::temp_directory_path() / ("eko_bench." + to_string(getpid()));
+    filesystem::create_directories(scratch);
+
+    vector<Result> results;
+    auto bench = [&](const string& name, size_t bytes, const function<void()>& body) {
+        if(!filter.empty() && name.find(filter) == string::npos) return;
+        results.push_back(measure(name, bytes, iterations, body));
+    };
+    for(size_t i = 0; i < corpora.size(); i++) {
+        const Corpus& corpus = corpora[i];
+        Pipeline& pipeline = pipelines[i];
+        size_t bytes = corpus.source.size();
+
+        bench("tokenize/" + corpus.name, bytes, [&] { Tokenizer(corpus.source).tokenize(); });
+        bench("lex+parse/" + corpus.name, bytes, [&] {
+            Tokenizer tokenizer(corpus.source);
+            Parser(tokenizer).parse();
+        });
+        bench("optimize/" + corpus.name, bytes, [&] { static_cast<void>(Optimizer(pipeline.tree).optimize()); });
+        bench("generate/" + corpus.name, bytes, [&] { static_cast<void>(Generator(pipeline.program, Target::EXECUTABLE).generateProgram()); });
+        bench("ir/" + corpus.name, bytes, [&] { static_cast<void>(generateFromIr(pipeline.program, Target::EXECUTABLE)); });
+        bench("peephole/" + corpus.name, bytes, [&] {
+            vector<Instruction> instructions = pipeline.instructions;
+            Peephole(instructions).run();
+        });
+        bench("encode/" + corpus.name, bytes, [&] { static_cast<void>(Encoder(pipeline.instructions).encode()); });
+        bench("compile/" + corpus.name, bytes, [&] { build(corpus.source, Target::EXECUTABLE); });
+        // The same pipeline through the library, whose compiler reuses the AST arrays between compiles.
+        Compiler compiler;
+        if(compiler.compile(corpus.source).code != build(corpus.source, Target::EXECUTABLE).code) {
+            cerr << "The library and the pipeline compile `" << corpus.name << "` differently." << endl;
+            return EXIT_FAILURE;
+        }
+        bench("libeko/" + corpus.name, bytes, [&] { static_cast<void>(compiler.compile(corpus.source)); });
+
+        // Editor style turnaround: a number in the middle of the corpus moves to its own line and then changes
+        // back and forth, the incremental parser re-parses the statements around it only. The edited tree has to
+        // compile like the edited source.
+        IncrementalParser incremental(corpus.source);
+        Tokenizer numbers(corpus.source);
+        optional<Token> number;
+        while((number = numbers.next()) && (number->type != TokenType::NUMBER || number->offset < corpus.source.size() / 2)) { }
+        string edited = corpus.source;
+        edited.insert(number->offset, "\n");
+        incremental.edit(number->offset, number->offset, "\n");
+        if(compiler.compile(incremental.program()).code != build(edited, Target::EXECUTABLE).code) {
+            cerr << "The incrementally parsed and the parsed `" << corpus.name << "` compile differently." << endl;
+            return EXIT_FAILURE;
+        }
+        string current(number->value), other = "7";
+        bench("reparse/" + corpus.name, 0, [&] {
+            incremental.edit(number->offset + 1, number->offset + 1 + current.size(), other);
+            swap(current, other);
+        });
+
+        // Runtime of the produced code, in process and as a standalone executable.
+        JitFunction jit(pipeline.code, pipeline.entry);
+        bench("run-jit/" + corpus.name, 0, [&] { jit.run(); });
+        Pipeline executable = build(corpus.source, Target::EXECUTABLE);
+        filesystem::path path = scratch / corpus.name;
+        if(!ElfWriter(executable.code, executable.entry).write(path)) {
+            cerr << "Failed to write the executable `" << path.string() << "`." << endl;
+            return EXIT_FAILURE;
+        }
+        if(runExecutable(path) != static_cast<int>(JitFunction(pipeline.code, pipeline.entry).run() & 0xFF)) {
+            cerr << "The executable and the in-process run of `" << corpus.name << "` disagree." << endl;
+            return EXIT_FAILURE;
+        }
+        bench("run-exec/" + corpus.name, 0, [&] { runExecutable(path); });
+
+        vector<Instruction> irInstructions = generateFromIr(pipeline.program, Target::FUNCTION);
+        Peephole(irInstructions).run();
+        Encoder irEncoder(irInstructions);
+        vector<uint8_t> irCode = irEncoder.encode();
+        JitFunction irJit(irCode, irEncoder.labelOffset("_start"));
+        if(irJit.run() != jit.run()) {
+            cerr << "The code generated from the IR and from the AST disagree on `" << corpus.name << "`." << endl;
+            return EXIT_FAILURE;
+        }
+        bench("run-jit-ir/" + corpus.name, 0, [&] { irJit.run(); });
+    }
+    filesystem::remove_all(scratch);
+
+    cout << left << setw(24) << "# benchmark" << right << setw(12) << "median_ms" << setw(12) << "min_ms" << setw(12) << "MB/s" << "\n";
+    for(const Result& result : results) {
+        cout << left << setw(24) << result.name << right << fixed << setprecision(3) << setw(12) << result.median << setw(12) << result.minimum;
+        if(result.bytes > 0) cout << setw(12) << setprecision(2) << result.bytes / (result.median * 1000.0);
+        else cout << setw(12) << "-";
+        cout << "\n";
+    }
+    return EXIT_SUCCESS;
+}
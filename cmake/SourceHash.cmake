@@ -0,0 +1,21 @@
+# Writes OUTPUT, a header defining EKO_SOURCE_HASH as a hash over the contents of libeko's sources in SOURCE_DIR.
+# Run with `cmake -DSOURCE_DIR=<dir> -DOUTPUT=<header> -P SourceHash.cmake`. The header is only rewritten when the
+# hash changes, so an unchanged tree does not recompile anything.
+file(GLOB sources RELATIVE "${SOURCE_DIR}" "${SOURCE_DIR}/eko.cpp" "${SOURCE_DIR}/eko.hpp" "${SOURCE_DIR}/utils/*.hpp")
+list(SORT sources)
+set(digests "")
+foreach(source IN LISTS sources)
+    file(SHA256 "${SOURCE_DIR}/${source}" digest)
+    string(APPEND digests "${source} ${digest}\n")
+endforeach()
+string(SHA256 hash "${digests}")
+string(SUBSTRING "${hash}" 0 32 hash)
+
+set(header "// Generated from the sources of libeko by cmake/SourceHash.cmake.\n#define EKO_SOURCE_HASH \"${hash}\"\n")
+set(previous "")
+if(EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" previous)
+endif()
+if(NOT previous STREQUAL header)
+    file(WRITE "${OUTPUT}" "${header}")
+endif()
@@ -0,0 +1,139 @@
+#include <sstream>
+#include "eko.hpp"
+#include "utils/optimizer.hpp"
+#include "utils/resolver.hpp"
+#include "utils/gvn.hpp"
+#include "utils/irgen.hpp"
+#include "utils/peephole.hpp"
+#include "utils/encoder.hpp"
+#include "utils/elf.hpp"
+#include "source_hash.hpp"
+
+#ifndef EKO_VERSION
+#define EKO_VERSION "dev"
+#endif
+
+using namespace std;
+
+const char* buildId() {
+    return EKO_VERSION " " EKO_SOURCE_HASH;
+}
+
+const NodeProgram& Compiler::analyze(string_view source, const CompileOptions& options) {
+    CompileStatistics discarded;
+    CompileStatistics& statistics = options.statistics != nullptr ? *options.statistics : discarded;
+
+    // The parser pulls tokens as it goes, so lexing and parsing are timed as one pass.
+    Tokenizer tokenizer(source);
+    _program.clear();
+    {
+        Parser parser(tokenizer, move(_program));
+        auto timer = statistics.time("lex+parse");
+        optional<NodeProgram> tree = parser.parse();
+        if(!tree.has_value()) throw CompileError(0, "Failed to parse the input file.");
+        _program = move(tree.value());
+    }
+    statistics.count("tokens", tokenizer.count());
+    statistics.count("symbols", tokenizer.symbols().size());
+    if(options.statistics != nullptr) statistics.countNodes(_program);
+    return optimize(options, statistics);
+}
+
+const NodeProgram& Compiler::analyze(const NodeProgram& tree, const CompileOptions& options) {
+    CompileStatistics discarded;
+    CompileStatistics& statistics = options.statistics != nullptr ? *options.statistics : discarded;
+    _program = tree; // copies into the arrays of the last compile
+    return optimize(options, statistics);
+}
+
+CompileResult Compiler::compile(string_view source, const CompileOptions& options) {
+    CompileResult result;
+    try {
+        generate(analyze(source, options), options, result, options.instrument.has_value() ? sourceHash(source) : 0);
+    } catch(const CompileError& error) {
+        result.diagnostics.push_back(error.diagnostic());
+    }
+    return result;
+}
+
+CompileResult Compiler::compile(const NodeProgram& tree, const CompileOptions& options) {
+    CompileResult result;
+    try {
+        generate(analyze(tree, options), options, result);
+    } catch(const CompileError& error) {
+        result.diagnostics.push_back(error.diagnostic());
+    }
+    return result;
+}
+
+const NodeProgram& Compiler::optimize(const CompileOptions& options, CompileStatistics& statistics) {
+    if(options.optimize) {
+        auto timer = statistics.time("optimize");
+        Optimizer optimizer(move(_program));
+        _program = optimizer.optimize();
+        statistics.count("statements_eliminated", optimizer.eliminated());
+        statistics.count("calls_inlined", optimizer.inlined());
+    }
+    return _program;
+}
+
+void Compiler::generate(const NodeProgram& program, const CompileOptions& options, CompileResult& result, uint64_t hash) {
+    CompileStatistics discarded;
+    CompileStatistics& statistics = options.statistics != nullptr ? *options.statistics : discarded;
+    if(options.ir) {
+        IrFunction function;
+        {
+            auto timer = statistics.time("ir-build");
+            if(!options.optimize) NameResolver(program).run(); // the IR skips function bodies, the optimizer checked them otherwise
+            function = IrBuilder(program).build();
+        }
+        {
+            auto timer = statistics.time("gvn");
+            statistics.count("gvn_removed", ValueNumbering(function).run());
+        }
+        if(options.irDump != nullptr) {
+            ostringstream dump;
+            function.print(dump);
+            *options.irDump << dump.str() << flush;
+        }
+        statistics.count("ir_blocks", function.layout.size());
+        IrGenerator generator(function, options.target);
+        {
+            auto timer = statistics.time("generate");
+            result.instructions = generator.generate();
+        }
+        statistics.count("spilled_values", generator.spilled());
+    } else {
+        if(options.instrument.has_value()) {
+            optional<uint64_t> address;
+            if(options.target == Target::EXECUTABLE) address = ElfWriter::dataAddress;
+            result.instrumentation.emplace(program, hash, *options.instrument, address);
+        }
+        Generator generator(program, options.target, result.instrumentation ? &*result.instrumentation : nullptr, options.profile);
+        {
+            auto timer = statistics.time("generate");
+            result.instructions = generator.generateProgram();
+        }
+        if(result.instrumentation.has_value()) statistics.count("branches_instrumented", result.instrumentation->branches());
+        if(options.profile != nullptr) statistics.count("scopes_outlined", generator.outlined());
+    }
+    statistics.count("instructions_generated", result.instructions.size());
+    if(options.peephole) {
+        {
+            auto timer = statistics.time("peephole");
+            result.rewrites = Peephole(result.instructions).run();
+        }
+        statistics.count("peephole_rewrites", result.rewrites);
+    }
+    statistics.count("instructions", result.instructions.size());
+
+    if(options.encode) {
+        Encoder encoder(result.instructions);
+        {
+            auto timer = statistics.time("encode");
+            result.code = encoder.encode();
+        }
+        result.entry = encoder.labelOffset("_start");
+        statistics.count("code_bytes", result.code.size());
+    }
+}
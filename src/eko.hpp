@@ -0,0 +1,70 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string_view>
+#include <optional>
+#include <filesystem>
+#include "utils/ast.hpp"
+#include "utils/instructions.hpp"
+#include "utils/generator.hpp"
+#include "utils/diagnostics.hpp"
+#include "utils/incremental.hpp"
+#include "utils/profile.hpp"
+#include "utils/stats.hpp"
+
+using namespace std;
+
+// The compiler as a library: source text in, machine code or diagnostics out, without touching files or the process.
+// A Compiler keeps the AST arrays of its last compile and reuses them for the next one. Instances share no state,
+// so separate instances can compile on separate threads.
+
+// Identifies this build of the library by its version and a hash of its sources, which every change to a pass
+// changes, so results cached across runs have to include it in their key.
+const char* buildId();
+
+struct CompileOptions {
+    bool optimize = true;
+    bool peephole = true;
+    bool ir = false; // generate through the SSA IR and value numbering
+    bool encode = true; // without it only the instructions are produced, for assembly output
+    Target target = Target::EXECUTABLE;
+    ostream* irDump = nullptr; // receives the IR after value numbering
+    CompileStatistics* statistics = nullptr; // pass timings and counters
+    // Both only apply to the AST generator, --ir code is neither counted nor laid out by a profile.
+    optional<filesystem::path> instrument {}; // count every branch, the profile is written to this path
+    const Profile* profile = nullptr; // moves scopes the profile saw rarely run out of line
+};
+
+struct CompileResult {
+    vector<Diagnostic> diagnostics {};
+    vector<Instruction> instructions {};
+    vector<uint8_t> code {};
+    size_t entry = 0; // offset of `_start` in `code`
+    size_t rewrites = 0; // applied by the peephole optimizer
+    // The counters of an instrumented compile. An executable maps the block at ElfWriter::dataAddress, FUNCTION
+    // code counts into the block itself, which has to stay alive while it runs and is written out afterwards.
+    optional<Instrumentation> instrumentation {};
+
+    [[nodiscard]] inline bool succeeded() const { return diagnostics.empty(); }
+};
+
+class Compiler {
+    public:
+        // Errors are returned as diagnostics, `source` only has to live for the call.
+        CompileResult compile(string_view source, const CompileOptions& options = {});
+
+        // Compiles a tree that is already parsed, such as the one an IncrementalParser keeps up to date.
+        CompileResult compile(const NodeProgram& tree, const CompileOptions& options = {});
+
+        // Parses and optimizes `source` and throws CompileError on the first error. The program refers to
+        // `source` and is valid until the next call.
+        const NodeProgram& analyze(string_view source, const CompileOptions& options = {});
+        const NodeProgram& analyze(const NodeProgram& tree, const CompileOptions& options = {});
+
+    private:
+        NodeProgram _program {};
+
+        const NodeProgram& optimize(const CompileOptions& options, CompileStatistics& statistics);
+        void generate(const NodeProgram& program, const CompileOptions& options, CompileResult& result, uint64_t hash = 0);
+};
@@ -2,47 +2,305 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <set>
 
-#include "utils/generator.hpp"
+#include "eko.hpp"
+#include "utils/source.hpp"
+#include "utils/elf.hpp"
+#include "utils/jit.hpp"
+#include "utils/interpreter.hpp"
+#include "utils/cache.hpp"
+#include "utils/threadpool.hpp"
+#include "utils/stats.hpp"
 
 using namespace std;
 
-int main(int argc, char* argv[]) {
-    if(argc != 2) {
-        cerr << "Incorrect Usage of the Tool!\nCorrect Usage: \"eko <file_name.eko>\"" << endl;
+struct Options {
+    bool optimize = true;
+    bool peephole = true;
+    bool verbose = false;
+    bool nasm = false;
+    bool run = false;
+    bool interpret = false;
+    bool ir = false;
+    bool dumpIr = false;
+    bool instrument = false;
+    bool profileUse = false;
+    bool cache = false;
+    bool cacheStats = false;
+    filesystem::path cacheDirectory = CompilationCache::defaultDirectory();
+    uintmax_t cacheSize = 256;
+    bool timePasses = false;
+    bool stats = false;
+    CompileStatistics::Format statsFormat = CompileStatistics::Format::TEXT;
+    size_t jobs = 1;
+    optional<filesystem::path> outDirectory {};
+    optional<filesystem::path> output {};
+    vector<const char*> files {};
+};
+
+// Prints one message to stderr in a single write, so lines from parallel compiles do not interleave. Batches name
+// the file the message is about.
+static void report(const Options& options, const char* file, const string& message) {
+    string line = options.files.size() > 1 ? string(file) + ": " + message + "\n" : message + "\n";
+    cerr << line << flush;
+}
+
+// Compiles one file to `outputPath`, or runs it for --run and --interp. Calls on different threads share
+// nothing but the cache.
+static int compileFile(const Options& options, const char* file, const filesystem::path& outputPath, CompilationCache* compilationCache, CompileStatistics& statistics) {
+    optional<SourceFile> source;
+    {
+        auto timer = statistics.time("read");
+        source.emplace(file);
+    }
+    if(source->failed()) {
+        report(options, file, "Failed to read the input file `" + string(file) + "`.");
         return EXIT_FAILURE;
     }
-    
-    string contents;
-    {
-        stringstream content_stream;
-        fstream input(argv[1], ios::in);
-        content_stream << input.rdbuf();
-        contents = content_stream.str();
-        input.close();
+
+    // Profiles sit next to their source, an instrumented executable writes to the absolute path wherever it runs.
+    filesystem::path profilePath = filesystem::absolute(file).string() + ".profile";
+    string profileBytes;
+    optional<Profile> profile;
+    if(options.profileUse) {
+        ifstream input(profilePath, ios::binary);
+        profileBytes.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+        profile = Profile::parse(profileBytes);
+        if(!profile.has_value()) {
+            report(options, file, "Failed to read the profile `" + profilePath.string() + "`, record one with --instrument.");
+            return EXIT_FAILURE;
+        }
+        if(!profile->matches(sourceHash(source->view()))) {
+            report(options, file, "Ignoring the profile `" + profilePath.string() + "`, it was recorded for a different version of `" + file + "`.");
+            profile.reset();
+            profileBytes.clear();
+        }
+    }
+
+    // Only produced executables are cached, --run and --interp always execute the program.
+    string cacheKey;
+    if(compilationCache != nullptr) {
+        string flags = string(options.optimize ? "O" : "") + (options.peephole ? "P" : "") + (options.nasm ? "N" : "") + (options.ir ? "I" : "") + (options.instrument ? "T" : "");
+        string profileKey = options.instrument ? profilePath.string() : profileBytes; // the baked in path, or the layout's input
+        cacheKey = CompilationCache::key({ source->view(), buildId(), flags, profileKey });
+        auto timer = statistics.time("cache");
+        bool hit = compilationCache->fetch(cacheKey, outputPath);
+        statistics.count("cache_hits", hit ? 1 : 0);
+        if(hit) return EXIT_SUCCESS;
     }
+    statistics.count("source_bytes", source->view().size());
 
-    Tokenizer tokenizer(move(contents));
-    vector<Token> tokens = tokenizer.tokenize();
+    // One compiler per thread, so the AST arrays of a file are reused for the next one the thread compiles.
+    thread_local Compiler compiler;
+    CompileOptions compileOptions {
+        .optimize = options.optimize,
+        .peephole = options.peephole,
+        .ir = options.ir,
+        .encode = !options.nasm,
+        .target = options.run ? Target::FUNCTION : Target::EXECUTABLE,
+        .irDump = options.dumpIr ? &cerr : nullptr,
+        .statistics = options.stats || options.timePasses ? &statistics : nullptr,
+        .instrument = options.instrument ? optional(profilePath) : nullopt,
+        .profile = profile.has_value() ? &*profile : nullptr,
+    };
 
-    Parser parser(move(tokens));
-    optional<NodeProgram> tree = parser.parse();
+    if(options.interpret) {
+        BytecodeProgram bytecode;
+        try {
+            const NodeProgram& program = compiler.analyze(source->view(), compileOptions);
+            auto timer = statistics.time("bytecode");
+            bytecode = BytecodeCompiler(program).compile();
+        } catch(const CompileError& error) {
+            report(options, file, error.what());
+            return EXIT_FAILURE;
+        }
+        statistics.count("bytecode_instructions", bytecode.code.size());
+        uint64_t exitCode;
+        {
+            auto timer = statistics.time("interpret");
+            exitCode = Interpreter(bytecode).run();
+        }
+        cout << "Program exited with code " << exitCode << "." << endl;
+        return static_cast<int>(exitCode & 0xFF);
+    }
 
-    if(!tree.has_value()) {
-        cerr << "Failed to parse the input file." << endl;
-        exit(EXIT_FAILURE);
+    CompileResult result = compiler.compile(source->view(), compileOptions);
+    if(!result.succeeded()) {
+        for(const Diagnostic& diagnostic : result.diagnostics) report(options, file, diagnostic.message);
+        return EXIT_FAILURE;
+    }
+    if(options.peephole && options.verbose) {
+        ostringstream message; // one write, so lines from parallel compiles do not interleave
+        message << "Peephole optimizer applied " << result.rewrites << " rewrites" << (options.files.size() > 1 ? string(" to ") + file : "") << ".\n";
+        cout << message.str() << flush;
     }
 
-    Generator generator(tree.value());
+    if(options.run) {
+        uint64_t exitCode;
+        {
+            auto timer = statistics.time("execute");
+            exitCode = JitFunction(result.code, result.entry).run();
+        }
+        if(result.instrumentation.has_value() && !result.instrumentation->write()) {
+            report(options, file, "Failed to write the profile `" + profilePath.string() + "`.");
+        }
+        cout << "Program exited with code " << exitCode << "." << endl;
+        return static_cast<int>(exitCode & 0xFF);
+    } else if(options.nasm) {
+        filesystem::path assemblyPath = outputPath.string() + ".asm";
+        filesystem::path objectPath = outputPath.string() + ".o";
+        {
+            auto timer = statistics.time("write");
+            fstream output(assemblyPath, ios::out);
+            writeAssembly(output, result.instructions);
+            output.close();
+        }
 
-    {
-        fstream output("../out/output.asm", ios::out);
-        output << generator.generateProgram();
-        output.close();
+        bool assembled;
+        {
+            auto timer = statistics.time("assemble");
+            assembled = system(("nasm -felf64 \"" + assemblyPath.string() + "\" -o \"" + objectPath.string() + "\"").c_str()) == 0;
+        }
+        bool linked;
+        {
+            auto timer = statistics.time("link");
+            linked = assembled && system(("ld -o \"" + outputPath.string() + "\" \"" + objectPath.string() + "\"").c_str()) == 0;
+        }
+        if(!linked) {
+            report(options, file, "Failed to assemble and link `" + string(file) + "`.");
+            return EXIT_FAILURE;
+        }
+    } else {
+        auto timer = statistics.time("write");
+        span<const uint8_t> data;
+        if(result.instrumentation.has_value()) data = result.instrumentation->block();
+        if(!ElfWriter(result.code, result.entry, data).write(outputPath)) {
+            report(options, file, "Failed to write the output file `" + outputPath.string() + "`.");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(compilationCache != nullptr && filesystem::exists(outputPath)) {
+        auto timer = statistics.time("cache");
+        compilationCache->store(cacheKey, outputPath);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// A lone file keeps the historical `../out/output`, batches get one executable per source named after its stem.
+static vector<filesystem::path> outputPaths(const Options& options) {
+    if(options.output.has_value()) return { *options.output };
+    filesystem::path directory = options.outDirectory.value_or("../out");
+    if(options.files.size() == 1 && !options.outDirectory.has_value()) return { directory / "output" };
+    vector<filesystem::path> paths;
+    set<filesystem::path> seen;
+    for(const char* file : options.files) {
+        filesystem::path path = directory / filesystem::path(file).stem();
+        if(!seen.insert(path).second) {
+            cerr << "Two input files would both be written to `" << path.string() << "`, compile them separately with -o." << endl;
+            exit(EXIT_FAILURE);
+        }
+        paths.push_back(path);
+    }
+    return paths;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    bool validUsage = true;
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "--no-peephole") options.peephole = false;
+        else if(arg == "--no-optimize") options.optimize = false;
+        else if(arg == "--verbose") options.verbose = true;
+        else if(arg == "--nasm") options.nasm = true;
+        else if(arg == "--run") options.run = true;
+        else if(arg == "--interp") options.interpret = true;
+        else if(arg == "--ir") options.ir = true;
+        else if(arg == "--dump-ir") options.ir = options.dumpIr = true;
+        else if(arg == "--instrument") options.instrument = true;
+        else if(arg == "--profile-use") options.profileUse = true;
+        else if(arg == "--cache") options.cache = true;
+        else if(arg == "--cache-stats") options.cacheStats = true;
+        else if(arg == "--time-passes") options.timePasses = true;
+        else if(arg == "--stats") options.stats = true;
+        else if(arg == "--stats-format" && i + 1 < argc) {
+            string format = argv[++i];
+            if(format == "json") options.statsFormat = CompileStatistics::Format::JSON;
+            else if(format == "text") options.statsFormat = CompileStatistics::Format::TEXT;
+            else validUsage = false;
+        }
+        else if(arg == "--cache-dir" && i + 1 < argc) {
+            options.cache = true;
+            options.cacheDirectory = argv[++i];
+        } else if(arg == "--cache-size" && i + 1 < argc) {
+            options.cache = true;
+            options.cacheSize = strtoull(argv[++i], nullptr, 10);
+        } else if(arg == "-j" && i + 1 < argc) {
+            options.jobs = strtoull(argv[++i], nullptr, 10);
+            if(options.jobs == 0) validUsage = false;
+        } else if(arg.starts_with("-j") && arg.size() > 2) {
+            options.jobs = strtoull(arg.c_str() + 2, nullptr, 10);
+            if(options.jobs == 0) validUsage = false;
+        } else if(arg == "--out-dir" && i + 1 < argc) options.outDirectory = argv[++i];
+        else if(arg == "-o" && i + 1 < argc) options.output = argv[++i];
+        else if(arg == "-" || !arg.starts_with("-")) options.files.push_back(argv[i]); // `-` reads stdin
+        else validUsage = false;
+    }
+    if(options.cacheStats && options.files.empty() && validUsage) {
+        CompilationCache(options.cacheDirectory, options.cacheSize * 1024 * 1024).printStats(cout);
+        return EXIT_SUCCESS;
+    }
+    bool executes = options.run || options.interpret;
+    if(options.ir && options.interpret) validUsage = false; // the interpreter runs the AST
+    // profiles are recorded and used by the AST generator's machine code, assembly output has no data segment
+    if((options.instrument || options.profileUse) && (options.ir || options.interpret || options.nasm)) validUsage = false;
+    if(options.instrument && options.profileUse) validUsage = false;
+    if(options.files.size() > 1 && (executes || options.output.has_value())) validUsage = false; // one exit code, one output path
+    if(!validUsage || options.files.empty()) {
+        cerr << "Incorrect Usage of the Tool!\nCorrect Usage: \"eko [--run | --interp] [--ir] [--dump-ir] [--instrument | --profile-use] [--no-optimize] [--no-peephole] [--nasm] [--verbose]"
+             << " [--cache] [--cache-dir <dir>] [--cache-size <MiB>] [--cache-stats]"
+             << " [--time-passes] [--stats] [--stats-format <text|json>]"
+             << " [-j <jobs>] [--out-dir <dir> | -o <output>] <file_name.eko>...\"" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // Reports go to stderr, stdout belongs to the compiled program's exit message.
+    auto compile = [&](const char* file, const filesystem::path& outputPath, CompilationCache* cache) {
+        CompileStatistics statistics;
+        int result = compileFile(options, file, outputPath, cache, statistics);
+        if(options.timePasses || options.stats) statistics.print(cerr, options.statsFormat, file, options.timePasses, options.stats);
+        return result;
+    };
+
+    if(executes) return compile(options.files.front(), {}, nullptr);
+
+    vector<filesystem::path> paths = outputPaths(options);
+    if(options.outDirectory.has_value()) {
+        error_code error;
+        filesystem::create_directories(*options.outDirectory, error);
     }
 
-    system("nasm -felf64 ../out/output.asm");
-    system("ld -o ../out/output ../out/output.o");
+    optional<CompilationCache> compilationCache;
+    if(options.cache) compilationCache.emplace(options.cacheDirectory, options.cacheSize * 1024 * 1024);
+    CompilationCache* cache = compilationCache.has_value() ? &compilationCache.value() : nullptr;
+
+    vector<int> results(options.files.size(), EXIT_SUCCESS);
+    if(options.jobs == 1 || options.files.size() == 1) {
+        for(size_t i = 0; i < options.files.size(); i++) results[i] = compile(options.files[i], paths[i], cache);
+    } else {
+        ThreadPool pool(min(options.jobs, options.files.size()));
+        for(size_t i = 0; i < options.files.size(); i++) {
+            pool.submit([&, i] { results[i] = compile(options.files[i], paths[i], cache); });
+        }
+        pool.wait();
+    }
 
+    if(options.cacheStats && cache != nullptr) cache->printStats(cout);
+    for(int result : results) {
+        if(result != EXIT_SUCCESS) return result;
+    }
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+#include <bit>
+#include "instructions.hpp"
+
+using namespace std;
+
+// Cheaper sequences for multiplying and dividing by constants, shared by the code generators.
+// Both write `result`, which may be the operand itself, and only ever clobber rax and rdx on top of it.
+
+// The factors of `odd` out of 3, 5 and 9 that one or two lea can multiply by, empty if there are none.
+inline vector<uint8_t> leaChain(uint64_t odd) {
+    static constexpr uint8_t factors[] = { 3, 5, 9 };
+    for(uint8_t first : factors) {
+        if(odd == first) return { first };
+        for(uint8_t second : factors) {
+            if(odd == static_cast<uint64_t>(first) * second) return { first, second };
+        }
+    }
+    return {};
+}
+
+struct DivisionMagic { uint64_t multiplier; int shift; bool add; };
+
+// For a divisor that is not a power of two, x / divisor == high(x * multiplier) >> shift,
+// or with `add` the 65 bit multiplier 2^64 + multiplier is applied through the (x - hi) / 2 + hi step.
+inline DivisionMagic divisionMagic(uint64_t divisor) {
+    int log = 63 - countl_zero(divisor);
+    unsigned __int128 numerator = static_cast<unsigned __int128>(1) << (64 + log);
+    uint64_t proposed = static_cast<uint64_t>(numerator / divisor);
+    uint64_t remainder = static_cast<uint64_t>(numerator % divisor);
+    if(divisor - remainder < (uint64_t{1} << log)) return { .multiplier = proposed + 1, .shift = log, .add = false };
+    uint64_t twiceRemainder = remainder + remainder;
+    proposed += proposed;
+    if(twiceRemainder >= divisor || twiceRemainder < remainder) proposed++;
+    return { .multiplier = proposed + 1, .shift = log, .add = true };
+}
+
+// A shift for powers of two, lea for the odd factors 3, 5 and 9 and their products, imul with an immediate
+// for the rest. The low 64 bits are the same as those of a full multiplication.
+inline void multiplyByConstant(vector<Instruction>& out, Register result, const Operand& operand, uint64_t factor) {
+    if(factor == 0) {
+        out.push_back({.opcode = Opcode::MOV, .operands = { result, Immediate{0} }});
+        return;
+    }
+    if(!(operand == Operand(result))) out.push_back({.opcode = Opcode::MOV, .operands = { result, operand }});
+    int shift = countr_zero(factor);
+    vector<uint8_t> chain = leaChain(factor >> shift);
+    if((factor >> shift) == 1 || (!chain.empty() && chain.size() + (shift > 0 ? 1 : 0) <= 2)) {
+        for(uint8_t odd : chain) out.push_back({.opcode = Opcode::LEA, .operands = { result, Memory{.base = result, .offset = 0, .index = result, .scale = static_cast<uint8_t>(odd - 1)} }});
+        if(shift > 0) out.push_back({.opcode = Opcode::SHL, .operands = { result, Immediate{static_cast<uint64_t>(shift)} }});
+    } else if(static_cast<int64_t>(factor) >= INT32_MIN && static_cast<int64_t>(factor) <= INT32_MAX) {
+        out.push_back({.opcode = Opcode::IMUL, .operands = { result, result, Immediate{factor} }}); // the immediate is sign extended
+    } else {
+        out.push_back({.opcode = Opcode::MOV, .operands = { Register::RDX, Immediate{factor} }});
+        out.push_back({.opcode = Opcode::IMUL, .operands = { result, Register::RDX }});
+    }
+}
+
+// Unsigned division by a non zero constant: a shift for powers of two, otherwise a multiplication by
+// a fixed point reciprocal that keeps the high half of the product, see Granlund and Montgomery.
+// The dividend is a register other than rax and rdx, or memory.
+inline void divideByConstant(vector<Instruction>& out, Register result, const Operand& dividend, uint64_t divisor) {
+    auto emit = [&](Opcode opcode, vector<Operand> operands) { out.push_back({.opcode = opcode, .operands = move(operands)}); };
+    if(has_single_bit(divisor)) {
+        if(!(dividend == Operand(result))) emit(Opcode::MOV, { result, dividend });
+        if(divisor > 1) emit(Opcode::SHR, { result, Immediate{static_cast<uint64_t>(countr_zero(divisor))} });
+        return;
+    }
+    DivisionMagic magic = divisionMagic(divisor);
+    emit(Opcode::MOV, { Register::RAX, Immediate{magic.multiplier} });
+    emit(Opcode::MUL, { dividend }); // rdx holds the high half of the product
+    if(!magic.add) {
+        emit(Opcode::SHR, { Register::RDX, Immediate{static_cast<uint64_t>(magic.shift)} });
+        emit(Opcode::MOV, { result, Register::RDX });
+        return;
+    }
+    // the multiplier needs 65 bits, its top bit is added back without overflowing: (x - hi) / 2 + hi
+    Register work = dividend == Operand(result) ? result : Register::RAX;
+    if(work == Register::RAX) emit(Opcode::MOV, { Register::RAX, dividend });
+    emit(Opcode::SUB, { work, Register::RDX });
+    emit(Opcode::SHR, { work, Immediate{1} });
+    emit(Opcode::ADD, { work, Register::RDX });
+    emit(Opcode::SHR, { work, Immediate{static_cast<uint64_t>(magic.shift)} });
+    if(work != result) emit(Opcode::MOV, { result, work });
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <string_view>
+#include <cstdint>
+
+using namespace std;
+
+// The AST is stored flat: every kind of node lives in its own contiguous array and nodes refer to each other
+// by 32 bit indices into those arrays, so walking a program touches a few dense arrays instead of chasing pointers.
+using NodeIndex = uint32_t;
+
+// The bytes [begin, end) of the source a node was parsed from.
+struct SourceSpan {
+    uint32_t begin = 0;
+    uint32_t end = 0;
+};
+
+enum class ExpressionKind : uint8_t { NUMBER, IDENTIFIER, CALL, ADD, SUBTRACT, MULTIPLY, DIVIDE };
+
+// Parentheses only guide the parser, they do not survive into the tree.
+struct NodeExpression {
+    ExpressionKind kind;
+    int line; // line of the expression's first token
+    union {
+        uint64_t value; // NUMBER
+        uint32_t symbol; // IDENTIFIER
+        uint32_t call; // CALL, index into `NodeProgram::calls`
+        NodeIndex operands[2]; // binary expressions, left and right
+    };
+
+    [[nodiscard]] inline bool isBinary() const { return kind >= ExpressionKind::ADD; }
+    [[nodiscard]] inline NodeIndex left() const { return operands[0]; }
+    [[nodiscard]] inline NodeIndex right() const { return operands[1]; }
+};
+
+enum class StatementKind : uint8_t { EXIT, LET, ASSIGNMENT, RETURN, SCOPE, IF, ELSE, WHILE, FUNCTION };
+
+struct NodeStatement {
+    StatementKind kind;
+    int line;
+    uint32_t symbol = 0; // LET and ASSIGNMENT, the name of a FUNCTION
+    NodeIndex expression = 0; // the value of EXIT, LET, ASSIGNMENT and RETURN, the condition of IF and WHILE
+    NodeIndex scope = 0; // SCOPE, IF, ELSE and WHILE, the body of a FUNCTION
+    uint32_t function = 0; // FUNCTION, index into `NodeProgram::functions`
+    SourceSpan span {}; // from the first token to the last, a scope's closing `}` included
+};
+
+// A call's arguments are a contiguous run of `NodeProgram::arguments`.
+struct NodeCall {
+    uint32_t symbol; // the function called
+    uint32_t first = 0;
+    uint32_t count = 0;
+};
+
+// A function's parameter symbols are a contiguous run of `NodeProgram::parameters`.
+struct NodeFunction {
+    uint32_t first = 0;
+    uint32_t count = 0;
+};
+
+// A scope's statements are a contiguous run of `NodeProgram::children`.
+struct NodeScope {
+    uint32_t first = 0;
+    uint32_t count = 0;
+    SourceSpan span {}; // from `{` to `}`, the whole parsed source for the root
+    int line = 0, lastLine = 0; // of the `{` and the `}`
+};
+
+struct NodeProgram {
+    vector<NodeExpression> expressions {};
+    vector<NodeStatement> statements {};
+    vector<NodeScope> scopes {};
+    vector<NodeIndex> children {}; // statement indices, grouped by scope
+    vector<NodeCall> calls {};
+    vector<NodeIndex> arguments {}; // expression indices, grouped by call
+    vector<NodeFunction> functions {};
+    vector<uint32_t> parameters {}; // symbols, grouped by function
+    vector<string_view> names {}; // identifier names by symbol, views into the source
+    NodeIndex root = 0; // the scope holding the top level statements
+
+    [[nodiscard]] inline const NodeExpression& expression(NodeIndex index) const { return expressions[index]; }
+    [[nodiscard]] inline const NodeStatement& statement(NodeIndex index) const { return statements[index]; }
+
+    [[nodiscard]] inline span<const NodeIndex> body(NodeIndex scope) const {
+        return { children.data() + scopes[scope].first, scopes[scope].count };
+    }
+
+    [[nodiscard]] inline span<const NodeIndex> argumentsOf(const NodeExpression& call) const {
+        const NodeCall& node = calls[call.call];
+        return { arguments.data() + node.first, node.count };
+    }
+
+    [[nodiscard]] inline span<const uint32_t> parametersOf(const NodeStatement& function) const {
+        const NodeFunction& node = functions[function.function];
+        return { parameters.data() + node.first, node.count };
+    }
+
+    [[nodiscard]] inline uint32_t callee(const NodeExpression& call) const { return calls[call.call].symbol; }
+
+    [[nodiscard]] inline string_view name(uint32_t symbol) const { return names[symbol]; }
+
+    NodeIndex addNumber(uint64_t value, int line) {
+        expressions.push_back({.kind = ExpressionKind::NUMBER, .line = line, .value = value});
+        return static_cast<NodeIndex>(expressions.size() - 1);
+    }
+
+    void addName(uint32_t symbol, string_view name) {
+        if(symbol >= names.size()) names.resize(symbol + 1);
+        names[symbol] = name;
+    }
+
+    NodeIndex addIdentifier(uint32_t symbol, string_view name, int line) {
+        addName(symbol, name);
+        expressions.push_back({.kind = ExpressionKind::IDENTIFIER, .line = line, .symbol = symbol});
+        return static_cast<NodeIndex>(expressions.size() - 1);
+    }
+
+    NodeIndex addBinary(ExpressionKind kind, NodeIndex left, NodeIndex right) {
+        expressions.push_back({.kind = kind, .line = expressions[left].line, .operands = { left, right }});
+        return static_cast<NodeIndex>(expressions.size() - 1);
+    }
+
+    NodeIndex addCall(uint32_t symbol, span<const NodeIndex> body, int line) {
+        calls.push_back({.symbol = symbol, .first = static_cast<uint32_t>(arguments.size()), .count = static_cast<uint32_t>(body.size())});
+        arguments.insert(arguments.end(), body.begin(), body.end());
+        expressions.push_back({.kind = ExpressionKind::CALL, .line = line, .call = static_cast<uint32_t>(calls.size() - 1)});
+        return static_cast<NodeIndex>(expressions.size() - 1);
+    }
+
+    uint32_t addFunction(span<const uint32_t> symbols) {
+        functions.push_back({.first = static_cast<uint32_t>(parameters.size()), .count = static_cast<uint32_t>(symbols.size())});
+        parameters.insert(parameters.end(), symbols.begin(), symbols.end());
+        return static_cast<uint32_t>(functions.size() - 1);
+    }
+
+    NodeIndex addStatement(NodeStatement statement) {
+        statements.push_back(statement);
+        return static_cast<NodeIndex>(statements.size() - 1);
+    }
+
+    // Scopes are added once all their statements are known, nested scopes therefore come before their parents.
+    NodeIndex addScope(span<const NodeIndex> body, SourceSpan source = {}, int line = 0, int lastLine = 0) {
+        scopes.push_back({.first = static_cast<uint32_t>(children.size()), .count = static_cast<uint32_t>(body.size()), .span = source, .line = line, .lastLine = lastLine});
+        children.insert(children.end(), body.begin(), body.end());
+        return static_cast<NodeIndex>(scopes.size() - 1);
+    }
+
+    struct Sizes { uint32_t expressions, statements, scopes, children, calls, arguments, functions, parameters; };
+
+    [[nodiscard]] inline Sizes sizes() const {
+        return { static_cast<uint32_t>(expressions.size()), static_cast<uint32_t>(statements.size()),
+                 static_cast<uint32_t>(scopes.size()), static_cast<uint32_t>(children.size()),
+                 static_cast<uint32_t>(calls.size()), static_cast<uint32_t>(arguments.size()),
+                 static_cast<uint32_t>(functions.size()), static_cast<uint32_t>(parameters.size()) };
+    }
+
+    // Drops the nodes added since `sizes` was taken.
+    inline void truncate(const Sizes& sizes) {
+        expressions.resize(sizes.expressions);
+        statements.resize(sizes.statements);
+        scopes.resize(sizes.scopes);
+        children.resize(sizes.children);
+        calls.resize(sizes.calls);
+        arguments.resize(sizes.arguments);
+        functions.resize(sizes.functions);
+        parameters.resize(sizes.parameters);
+    }
+
+    // Empties the program but keeps the arrays' memory for the next one.
+    inline void clear() {
+        expressions.clear();
+        statements.clear();
+        scopes.clear();
+        children.clear();
+        calls.clear();
+        arguments.clear();
+        functions.clear();
+        parameters.clear();
+        names.clear();
+        root = 0;
+    }
+
+    // Bytes held by the node arrays.
+    [[nodiscard]] inline size_t bytes() const {
+        return expressions.capacity() * sizeof(NodeExpression) + statements.capacity() * sizeof(NodeStatement)
+             + scopes.capacity() * sizeof(NodeScope) + children.capacity() * sizeof(NodeIndex) + names.capacity() * sizeof(string_view)
+             + calls.capacity() * sizeof(NodeCall) + arguments.capacity() * sizeof(NodeIndex)
+             + functions.capacity() * sizeof(NodeFunction) + parameters.capacity() * sizeof(uint32_t);
+    }
+};
+
+// An expression is pure if evaluating it can never trap, i.e. it holds no division by a possibly zero value and no
+// call, which may trap, exit or never return.
+inline bool isPure(const NodeProgram& program, NodeIndex index) {
+    const NodeExpression& expression = program.expression(index);
+    if(expression.kind == ExpressionKind::CALL) return false;
+    if(expression.kind == ExpressionKind::DIVIDE) {
+        const NodeExpression& divisor = program.expression(expression.right());
+        return divisor.kind == ExpressionKind::NUMBER && divisor.value != 0 && isPure(program, expression.left());
+    }
+    if(expression.isBinary()) return isPure(program, expression.left()) && isPure(program, expression.right());
+    return true;
+}
+
+// Appends the symbols assigned anywhere in the scope, nested scopes included, with repeats.
+inline void collectAssignments(const NodeProgram& program, NodeIndex scope, vector<uint32_t>& symbols) {
+    for(NodeIndex index : program.body(scope)) {
+        const NodeStatement& statement = program.statement(index);
+        if(statement.kind == StatementKind::ASSIGNMENT) symbols.push_back(statement.symbol);
+        else if(statement.kind >= StatementKind::SCOPE) collectAssignments(program, statement.scope, symbols);
+    }
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <utility>
+#include "parser.hpp"
+#include "symbols.hpp"
+
+using namespace std;
+
+// Register based bytecode: variables live in fixed registers, temporaries are stacked above them.
+// Every call gets a frame of registers of its own, starting at the caller's register holding the first argument.
+enum class Operation : uint8_t {
+    LOADK, // a = constants[b]
+    MOVE, // a = b
+    ADD, // a = b + c
+    SUB, // a = b - c
+    MUL, // a = b * c
+    DIV, // a = b / c
+    JUMPZ, // if a == 0 jump to b
+    JUMPNZ, // if a != 0 jump to b
+    JUMP, // jump to a
+    EXIT, // exit with a
+    CALL, // call functions[b] with the arguments in a and up, the result is left in a
+    RETURN // return a to the caller
+};
+
+struct BytecodeInstruction {
+    Operation op;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t c = 0;
+};
+
+struct BytecodeFunction {
+    uint32_t entry = 0;
+    uint32_t registerCount = 1; // at least the one the result is returned in
+};
+
+struct BytecodeProgram {
+    vector<BytecodeInstruction> code {};
+    vector<uint64_t> constants {};
+    vector<BytecodeFunction> functions {};
+    uint32_t registerCount = 0;
+};
+
+// Lowers the AST into bytecode with the same semantics as the native Generator.
+class BytecodeCompiler {
+    public:
+        inline explicit BytecodeCompiler(const NodeProgram& program): _program(program) { }
+
+        // Throws CompileError for the errors the optimizer would have reported, when the program is not optimized.
+        [[nodiscard]] BytecodeProgram compile() {
+            for(NodeIndex index : _program.body(_program.root)) {
+                const NodeStatement& statement = _program.statement(index);
+                if(statement.kind != StatementKind::FUNCTION || _functions.find(statement.symbol) != nullptr) continue;
+                _functions.declare(statement.symbol, static_cast<uint32_t>(_output.functions.size()));
+                _arity.push_back(_program.functions[statement.function].count);
+                _output.functions.emplace_back();
+            }
+            for(NodeIndex statement : _program.body(_program.root)) compileStatement(statement);
+            uint32_t zero = allocate();
+            emit(Operation::LOADK, zero, constant(0));
+            emit(Operation::EXIT, zero);
+            _output.registerCount = _frameSize;
+            return move(_output);
+        }
+
+    private:
+        const NodeProgram& _program;
+        BytecodeProgram _output {};
+        ScopedSymbolTable<uint32_t> _vars {};
+        uint32_t _top = 0; // first free register
+        uint32_t _frameSize = 0; // registers the current frame needs
+        vector<uint32_t> _scopeTops {};
+        ScopedSymbolTable<uint32_t> _functions {}; // index into the program's functions by name
+        vector<uint32_t> _arity {};
+
+        size_t emit(Operation op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0) {
+            _output.code.push_back({.op = op, .a = a, .b = b, .c = c});
+            return _output.code.size() - 1;
+        }
+
+        uint32_t constant(uint64_t value) {
+            _output.constants.push_back(value);
+            return static_cast<uint32_t>(_output.constants.size() - 1);
+        }
+
+        uint32_t allocate() {
+            _frameSize = max(_frameSize, _top + 1);
+            return _top++;
+        }
+
+        uint32_t compileExpression(NodeIndex index) {
+            const NodeExpression& expression = _program.expression(index);
+            switch(expression.kind) {
+                case ExpressionKind::NUMBER: {
+                    uint32_t reg = allocate();
+                    emit(Operation::LOADK, reg, constant(expression.value));
+                    return reg;
+                }
+                case ExpressionKind::IDENTIFIER: {
+                    const uint32_t* var = _vars.find(expression.symbol);
+                    if(var == nullptr) {
+                        throw CompileError(expression.line, "Invalid Syntax: Identifier `", _program.name(expression.symbol), "` does not exist at line ", expression.line, ".");
+                    }
+                    uint32_t reg = allocate();
+                    emit(Operation::MOVE, reg, *var);
+                    return reg;
+                }
+                case ExpressionKind::CALL: return compileCall(expression);
+                case ExpressionKind::ADD: return compileBinary(Operation::ADD, expression);
+                case ExpressionKind::SUBTRACT: return compileBinary(Operation::SUB, expression);
+                case ExpressionKind::MULTIPLY: return compileBinary(Operation::MUL, expression);
+                case ExpressionKind::DIVIDE: break;
+            }
+            return compileBinary(Operation::DIV, expression);
+        }
+
+        uint32_t compileBinary(Operation op, const NodeExpression& expression) {
+            uint32_t leftReg = compileExpression(expression.left());
+            uint32_t rightReg = compileExpression(expression.right());
+            emit(op, leftReg, leftReg, rightReg);
+            _top = leftReg + 1; // the right operand's temporaries are free again
+            return leftReg;
+        }
+
+        // The arguments are compiled into consecutive registers, which become the first ones of the callee's frame.
+        uint32_t compileCall(const NodeExpression& expression) {
+            uint32_t callee = _program.callee(expression);
+            const uint32_t* function = _functions.find(callee);
+            span<const NodeIndex> arguments = _program.argumentsOf(expression);
+            if(function == nullptr) {
+                throw CompileError(expression.line, "Invalid Syntax: Function `", _program.name(callee), "` does not exist at line ", expression.line, ".");
+            }
+            if(_arity[*function] != arguments.size()) {
+                throw CompileError(expression.line, "Invalid Syntax: Function `", _program.name(callee), "` takes ", _arity[*function], " arguments but ", arguments.size(), " were given at line ", expression.line, ".");
+            }
+            uint32_t base = _top;
+            for(NodeIndex argument : arguments) {
+                uint32_t reg = compileExpression(argument);
+                _top = reg + 1;
+            }
+            if(arguments.empty()) allocate();
+            emit(Operation::CALL, base, *function);
+            _top = base + 1;
+            return base;
+        }
+
+        // Compiled where it is defined, behind a jump over it.
+        void compileFunction(const NodeStatement& statement) {
+            uint32_t index = *_functions.find(statement.symbol);
+            if(_output.functions[index].entry != 0) { // never 0 once compiled, the jump over it comes first
+                throw CompileError(statement.line, "Function `", _program.name(statement.symbol), "` already exists at line ", statement.line, ".");
+            }
+            size_t jump = emit(Operation::JUMP);
+            _output.functions[index].entry = static_cast<uint32_t>(_output.code.size());
+
+            // a frame of its own, with the parameters in its first registers
+            ScopedSymbolTable<uint32_t> vars = exchange(_vars, {});
+            uint32_t top = exchange(_top, 0), frameSize = exchange(_frameSize, 1);
+            _vars.beginScope();
+            for(uint32_t parameter : _program.parametersOf(statement)) {
+                if(!_vars.declare(parameter, allocate())) {
+                    throw CompileError(statement.line, "Identifier `", _program.name(parameter), "` already exists at line ", statement.line, ".");
+                }
+            }
+            for(NodeIndex index : _program.body(statement.scope)) compileStatement(index);
+            uint32_t zero = allocate();
+            emit(Operation::LOADK, zero, constant(0)); // running off the end returns 0
+            emit(Operation::RETURN, zero);
+            _output.functions[index].registerCount = _frameSize;
+            _vars = move(vars);
+            _top = top;
+            _frameSize = frameSize;
+            _output.code[jump].a = static_cast<uint32_t>(_output.code.size());
+        }
+
+        void compileScope(NodeIndex scope) {
+            _vars.beginScope();
+            _scopeTops.push_back(_top);
+            for(NodeIndex statement : _program.body(scope)) compileStatement(statement);
+            _vars.endScope();
+            _top = _scopeTops.back();
+            _scopeTops.pop_back();
+        }
+
+        void compileStatement(NodeIndex index) {
+            const NodeStatement& statement = _program.statement(index);
+            switch(statement.kind) {
+                case StatementKind::EXIT: {
+                    uint32_t reg = compileExpression(statement.expression);
+                    emit(Operation::EXIT, reg);
+                    _top = reg;
+                    break;
+                }
+                case StatementKind::RETURN: {
+                    uint32_t reg = compileExpression(statement.expression);
+                    emit(Operation::RETURN, reg);
+                    _top = reg;
+                    break;
+                }
+                case StatementKind::FUNCTION:
+                    compileFunction(statement);
+                    break;
+                case StatementKind::LET: {
+                    if(_vars.find(statement.symbol) != nullptr) {
+                        throw CompileError(statement.line, "Identifier `", _program.name(statement.symbol), "` already exists at line ", statement.line, ".");
+                    }
+                    uint32_t reg = compileExpression(statement.expression); // the result register becomes the variable
+                    _vars.declare(statement.symbol, reg);
+                    break;
+                }
+                case StatementKind::ASSIGNMENT: {
+                    const uint32_t* var = _vars.find(statement.symbol);
+                    if(var == nullptr) {
+                        throw CompileError(statement.line, "Identifier `", _program.name(statement.symbol), "` does not exist at line ", statement.line, "!");
+                    }
+                    uint32_t target = *var;
+                    uint32_t reg = compileExpression(statement.expression);
+                    emit(Operation::MOVE, target, reg);
+                    _top = reg;
+                    break;
+                }
+                case StatementKind::SCOPE:
+                    compileScope(statement.scope);
+                    break;
+                case StatementKind::IF: {
+                    uint32_t reg = compileExpression(statement.expression);
+                    _top = reg;
+                    size_t jump = emit(Operation::JUMPZ, reg);
+                    compileScope(statement.scope);
+                    _output.code[jump].b = static_cast<uint32_t>(_output.code.size());
+                    break;
+                }
+                case StatementKind::ELSE:
+                    compileScope(statement.scope); // like the native code, the else scope follows the if unconditionally
+                    break;
+                case StatementKind::WHILE: {
+                    // rotated like the native code, the test is compiled first for the order of errors and moved after the body
+                    vector<BytecodeInstruction> code = exchange(_output.code, {});
+                    uint32_t reg = compileExpression(statement.expression);
+                    _top = reg;
+                    emit(Operation::JUMPNZ, reg);
+                    vector<BytecodeInstruction> test = exchange(_output.code, move(code));
+
+                    size_t jump = emit(Operation::JUMP); // enter at the test
+                    uint32_t body = static_cast<uint32_t>(_output.code.size());
+                    compileScope(statement.scope);
+                    _output.code[jump].a = static_cast<uint32_t>(_output.code.size());
+                    test.back().b = body;
+                    _output.code.insert(_output.code.end(), test.begin(), test.end());
+                    break;
+                }
+            }
+        }
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <unistd.h>
+
+using namespace std;
+
+// Content addressed store of compiled executables. Entries are keyed on a hash of the source bytes,
+// the compiler build and the code generation flags, and the least recently used ones are evicted
+// once the directory grows past its size limit. Hits and misses are counted in a `stats` file.
+class CompilationCache {
+    public:
+        inline CompilationCache(filesystem::path directory, uintmax_t maxBytes): _directory(move(directory)), _maxBytes(maxBytes) {
+            error_code error;
+            filesystem::create_directories(_directory, error);
+            if(error) {
+                cerr << "Failed to create the cache directory `" << _directory.string() << "`." << endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // `$EKO_CACHE_DIR`, `$XDG_CACHE_HOME/eko` or `~/.cache/eko`.
+        static filesystem::path defaultDirectory() {
+            if(const char* directory = getenv("EKO_CACHE_DIR")) return directory;
+            if(const char* cacheHome = getenv("XDG_CACHE_HOME")) return filesystem::path(cacheHome) / "eko";
+            if(const char* home = getenv("HOME")) return filesystem::path(home) / ".cache" / "eko";
+            return filesystem::temp_directory_path() / "eko-cache";
+        }
+
+        // 128 bit key from two differently seeded 64 bit FNV-1a passes over every part.
+        static string key(const vector<string_view>& parts) {
+            uint64_t first = 0xcbf29ce484222325ULL, second = 0x84222325cbf29ce4ULL;
+            for(string_view part : parts) {
+                for(unsigned char c : part) {
+                    first = (first ^ c) * 0x100000001b3ULL;
+                    second = (second ^ c) * 0x100000001b3ULL;
+                    second ^= second >> 29;
+                }
+                first = (first ^ 0xff) * 0x100000001b3ULL; // separates the parts so their boundaries matter
+                second = (second ^ 0xff) * 0x100000001b3ULL;
+            }
+            char hex[33];
+            snprintf(hex, sizeof(hex), "%016llx%016llx", static_cast<unsigned long long>(first), static_cast<unsigned long long>(second));
+            return hex;
+        }
+
+        // Copies the cached output to `output` and returns true on a hit.
+        bool fetch(const string& key, const filesystem::path& output) {
+            filesystem::path entry = _directory / key;
+            error_code error;
+            if(!filesystem::is_regular_file(entry, error)) {
+                record(false);
+                return false;
+            }
+            filesystem::copy_file(entry, output, filesystem::copy_options::overwrite_existing, error);
+            if(error) {
+                record(false);
+                return false;
+            }
+            filesystem::last_write_time(entry, filesystem::file_time_type::clock::now(), error); // most recently used
+            record(true);
+            return true;
+        }
+
+        void store(const string& key, const filesystem::path& output) {
+            filesystem::path entry = _directory / key;
+            size_t thread = hash<thread::id>{}(this_thread::get_id());
+            filesystem::path temporary = _directory / (key + ".tmp" + to_string(getpid()) + "-" + to_string(thread)); // unique per compiling thread
+            error_code error;
+            filesystem::copy_file(output, temporary, filesystem::copy_options::overwrite_existing, error);
+            if(!error) filesystem::rename(temporary, entry, error); // atomic, concurrent compilers never see half an entry
+            if(error) filesystem::remove(temporary, error);
+            evict();
+        }
+
+        void printStats(ostream& out) const {
+            auto [hits, misses] = readStats();
+            uintmax_t bytes = 0;
+            size_t entries = 0;
+            for(const Entry& entry : entriesOf()) {
+                bytes += entry.size;
+                entries++;
+            }
+            out << "Cache: " << _directory.string() << "\n";
+            out << "  entries: " << entries << " (" << bytes << " of " << _maxBytes << " bytes)\n";
+            out << "  hits: " << hits << ", misses: " << misses << endl;
+        }
+
+    private:
+        filesystem::path _directory;
+        uintmax_t _maxBytes;
+        mutex _statsMutex; // batch compiles share one cache between threads
+        struct Entry { filesystem::path path; uintmax_t size; filesystem::file_time_type used; };
+
+        vector<Entry> entriesOf() const {
+            vector<Entry> entries;
+            error_code error;
+            for(const auto& item : filesystem::directory_iterator(_directory, error)) {
+                if(!item.is_regular_file(error) || item.path().filename() == "stats" || item.path().extension().string().starts_with(".tmp")) continue;
+                entries.push_back({.path = item.path(), .size = item.file_size(error), .used = item.last_write_time(error)});
+            }
+            return entries;
+        }
+
+        void evict() {
+            vector<Entry> entries = entriesOf();
+            uintmax_t total = 0;
+            for(const Entry& entry : entries) total += entry.size;
+            if(total <= _maxBytes) return;
+            sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+            error_code error;
+            for(const Entry& entry : entries) {
+                if(total <= _maxBytes) break;
+                if(filesystem::remove(entry.path, error)) total -= entry.size;
+            }
+        }
+
+        pair<uint64_t, uint64_t> readStats() const {
+            uint64_t hits = 0, misses = 0;
+            ifstream input(_directory / "stats");
+            string name;
+            uint64_t value;
+            while(input >> name >> value) {
+                if(name == "hits") hits = value;
+                else if(name == "misses") misses = value;
+            }
+            return { hits, misses };
+        }
+
+        // The counters are best effort, concurrent compilers may lose an update.
+        void record(bool hit) {
+            lock_guard<mutex> lock(_statsMutex);
+            auto [hits, misses] = readStats();
+            (hit ? hits : misses)++;
+            ofstream output(_directory / "stats", ios::trunc);
+            output << "hits " << hits << "\nmisses " << misses << "\n";
+        }
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+// An error found while compiling, `message` is the full text the command line tool prints.
+struct Diagnostic {
+    int line; // 0 for internal errors that have no place in the source
+    string message;
+};
+
+// Thrown by the passes on the first error, so a compile can be abandoned without ending the process.
+class CompileError : public runtime_error {
+    public:
+        template<typename... Parts>
+        inline explicit CompileError(int line, const Parts&... parts): runtime_error(concatenate(parts...)), _line(line) { }
+
+        [[nodiscard]] inline Diagnostic diagnostic() const { return { .line = _line, .message = what() }; }
+
+    private:
+        int _line;
+
+        template<typename... Parts>
+        static string concatenate(const Parts&... parts) {
+            ostringstream message;
+            (message << ... << parts);
+            return message.str();
+        }
+};
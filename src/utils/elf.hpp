@@ -0,0 +1,92 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <span>
+#include <elf.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Writes a static x86-64 ELF executable with the code in a single read/execute segment. Data the program writes to,
+// such as profile counters, gets a read/write segment of its own in front of the code, starting at `dataAddress`.
+class ElfWriter {
+    public:
+        static constexpr uint64_t baseAddress = 0x400000;
+        static constexpr uint64_t headersSize = sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr);
+        static constexpr uint64_t dataAddress = baseAddress + sizeof(Elf64_Ehdr) + 2 * sizeof(Elf64_Phdr);
+        static constexpr uint64_t pageSize = 0x1000;
+
+        inline ElfWriter(const vector<uint8_t>& code, size_t entryOffset, span<const uint8_t> data = {}): _code(code), _entryOffset(entryOffset), _data(data) { }
+
+        // Returns false when the file cannot be written, a partly written file is removed.
+        [[nodiscard]] bool write(const string& path) const {
+            Elf64_Ehdr header {};
+            memcpy(header.e_ident, ELFMAG, SELFMAG);
+            header.e_ident[EI_CLASS] = ELFCLASS64;
+            header.e_ident[EI_DATA] = ELFDATA2LSB;
+            header.e_ident[EI_VERSION] = EV_CURRENT;
+            header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+            header.e_type = ET_EXEC;
+            header.e_machine = EM_X86_64;
+            header.e_version = EV_CURRENT;
+            header.e_phoff = sizeof(Elf64_Ehdr);
+            header.e_ehsize = sizeof(Elf64_Ehdr);
+            header.e_phentsize = sizeof(Elf64_Phdr);
+            header.e_phnum = _data.empty() ? 1 : 2;
+
+            // the segment maps the whole file, headers included, so the code starts right after them
+            Elf64_Phdr text {};
+            text.p_type = PT_LOAD;
+            text.p_flags = PF_R | PF_X;
+            text.p_offset = 0;
+            text.p_vaddr = baseAddress;
+            text.p_paddr = baseAddress;
+            text.p_filesz = headersSize + _code.size();
+            text.p_memsz = text.p_filesz;
+            text.p_align = pageSize;
+
+            // with data the first segment maps the headers and the data writable, the code starts on the next page
+            Elf64_Phdr data = text;
+            uint64_t codeOffset = headersSize;
+            if(!_data.empty()) {
+                data.p_flags = PF_R | PF_W;
+                data.p_filesz = dataAddress - baseAddress + _data.size();
+                data.p_memsz = data.p_filesz;
+                codeOffset = (data.p_filesz + pageSize - 1) / pageSize * pageSize;
+                text.p_offset = codeOffset;
+                text.p_vaddr = text.p_paddr = baseAddress + codeOffset;
+                text.p_filesz = text.p_memsz = _code.size();
+            }
+            header.e_entry = baseAddress + codeOffset + _entryOffset;
+
+            fstream output(path, ios::out | ios::binary | ios::trunc);
+            if(!output) return false;
+            output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            if(!_data.empty()) {
+                output.write(reinterpret_cast<const char*>(&data), sizeof(data));
+                output.write(reinterpret_cast<const char*>(&text), sizeof(text));
+                output.write(reinterpret_cast<const char*>(_data.data()), _data.size());
+                vector<char> padding(codeOffset - data.p_filesz, 0);
+                output.write(padding.data(), padding.size());
+            } else {
+                output.write(reinterpret_cast<const char*>(&text), sizeof(text));
+            }
+            output.write(reinterpret_cast<const char*>(_code.data()), _code.size());
+            output.close();
+            if(!output) {
+                remove(path.c_str());
+                return false;
+            }
+            chmod(path.c_str(), 0755);
+            return true;
+        }
+
+    private:
+        const vector<uint8_t>& _code;
+        size_t _entryOffset;
+        span<const uint8_t> _data;
+};
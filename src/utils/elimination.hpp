@@ -0,0 +1,163 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include "ast.hpp"
+#include "resolver.hpp"
+
+using namespace std;
+
+// Removes statements that cannot affect the exit value: everything after an exit or return, lets of variables that
+// are never used, assignments whose value is never read and scopes left empty. Expressions that may trap are kept,
+// and so are calls and function definitions, whether they are needed is up to the generator.
+class DeadCodeEliminator {
+    public:
+        inline explicit DeadCodeEliminator(NodeProgram& program): _program(program),
+            _live(program.names.size(), false), _mentioned(program.names.size(), false) { }
+
+        // Returns the number of statements removed.
+        size_t run() {
+            NameResolver(_program).run(); // removing declarations must not hide the errors the generator would report
+            trimUnreachable(_program.root);
+            eliminateScope(_program.root);
+            return _removed;
+        }
+
+    private:
+        NodeProgram& _program;
+        vector<bool> _live; // by symbol: the variable's current value may still be read
+        vector<bool> _mentioned; // by symbol: a kept statement further on reads or assigns the variable
+        vector<uint32_t> _killed {}; // symbols a possibly skipped scope made dead, to be made live again
+        size_t _removed = 0;
+
+        // Drops the statements after one that always exits, returns whether the scope always exits.
+        bool trimUnreachable(NodeIndex scope) {
+            NodeScope& range = _program.scopes[scope];
+            for(uint32_t i = 0; i < range.count; i++) {
+                const NodeStatement& statement = _program.statement(_program.children[range.first + i]);
+                bool exits = statement.kind == StatementKind::EXIT || statement.kind == StatementKind::RETURN;
+                if(statement.kind == StatementKind::SCOPE || statement.kind == StatementKind::ELSE) exits = trimUnreachable(statement.scope); // else scopes always run
+                else if(statement.kind == StatementKind::IF || statement.kind == StatementKind::WHILE || statement.kind == StatementKind::FUNCTION) trimUnreachable(statement.scope);
+                if(exits) {
+                    // functions defined after an exit can still be called before it
+                    uint32_t kept = i + 1;
+                    for(uint32_t j = i + 1; j < range.count; j++) {
+                        NodeIndex index = _program.children[range.first + j];
+                        if(_program.statement(index).kind == StatementKind::FUNCTION) {
+                            trimUnreachable(_program.statement(index).scope);
+                            _program.children[range.first + kept++] = index;
+                        }
+                    }
+                    _removed += range.count - kept;
+                    range.count = kept;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void use(NodeIndex index) {
+            const NodeExpression& expression = _program.expression(index);
+            if(expression.kind == ExpressionKind::IDENTIFIER) {
+                _live[expression.symbol] = true;
+                _mentioned[expression.symbol] = true;
+            } else if(expression.isBinary()) {
+                use(expression.left());
+                use(expression.right());
+            } else if(expression.kind == ExpressionKind::CALL) {
+                for(NodeIndex argument : _program.argumentsOf(expression)) use(argument);
+            }
+        }
+
+        // Marks everything the scope reads as live, as if it ran again right after itself.
+        void useScope(NodeIndex scope) {
+            for(NodeIndex index : _program.body(scope)) {
+                const NodeStatement& statement = _program.statement(index);
+                if(statement.kind <= StatementKind::RETURN || statement.kind == StatementKind::IF || statement.kind == StatementKind::WHILE) use(statement.expression);
+                if(statement.kind >= StatementKind::SCOPE) useScope(statement.scope);
+            }
+        }
+
+        void kill(uint32_t symbol) {
+            if(_live[symbol]) _killed.push_back(symbol);
+            _live[symbol] = false;
+        }
+
+        // Walks the scope backwards from the variables live after it, removing the statements nothing reads.
+        void eliminateScope(NodeIndex scope) {
+            NodeScope& range = _program.scopes[scope];
+            vector<bool> keep(range.count, true);
+            for(uint32_t i = range.count; i-- > 0;) keep[i] = eliminateStatement(_program.statements[_program.children[range.first + i]]);
+            uint32_t kept = 0;
+            for(uint32_t i = 0; i < range.count; i++) {
+                if(keep[i]) _program.children[range.first + kept++] = _program.children[range.first + i];
+            }
+            _removed += range.count - kept;
+            range.count = kept;
+        }
+
+        // A scope that may be skipped leaves alive whatever was live after it, on top of what it reads itself.
+        void eliminateConditionalScope(NodeIndex scope) {
+            size_t mark = _killed.size();
+            eliminateScope(scope);
+            for(size_t i = mark; i < _killed.size(); i++) _live[_killed[i]] = true;
+            _killed.resize(mark);
+        }
+
+        // Returns false if the statement can be removed.
+        bool eliminateStatement(NodeStatement& statement) {
+            switch(statement.kind) {
+                case StatementKind::EXIT:
+                case StatementKind::RETURN:
+                    use(statement.expression); // whatever is live after it stays live, which is only ever conservative
+                    return true;
+                case StatementKind::FUNCTION: {
+                    // its names are its own, nothing is live at its end and its liveness does not leak out
+                    vector<bool> live = exchange(_live, vector<bool>(_live.size(), false));
+                    vector<bool> mentioned = exchange(_mentioned, vector<bool>(_mentioned.size(), false));
+                    vector<uint32_t> killed = exchange(_killed, {});
+                    eliminateScope(statement.scope);
+                    _live = move(live);
+                    _mentioned = move(mentioned);
+                    _killed = move(killed);
+                    return true;
+                }
+                case StatementKind::LET: {
+                    bool pure = isPure(_program, statement.expression);
+                    if(!_mentioned[statement.symbol] && pure) return false;
+                    if(!_live[statement.symbol] && pure && _program.expression(statement.expression).kind != ExpressionKind::NUMBER) {
+                        _program.expressions[statement.expression].kind = ExpressionKind::NUMBER; // later assignments still need the slot, not the value
+                        _program.expressions[statement.expression].value = 0;
+                    }
+                    kill(statement.symbol);
+                    _mentioned[statement.symbol] = false; // before its let the name belongs to no variable
+                    use(statement.expression);
+                    return true;
+                }
+                case StatementKind::ASSIGNMENT:
+                    if(!_live[statement.symbol] && isPure(_program, statement.expression)) return false;
+                    kill(statement.symbol);
+                    _mentioned[statement.symbol] = true;
+                    use(statement.expression);
+                    return true;
+                case StatementKind::SCOPE:
+                case StatementKind::ELSE:
+                    eliminateScope(statement.scope);
+                    return _program.scopes[statement.scope].count > 0;
+                case StatementKind::IF:
+                    eliminateConditionalScope(statement.scope);
+                    if(_program.scopes[statement.scope].count == 0 && isPure(_program, statement.expression)) return false;
+                    use(statement.expression);
+                    return true;
+                case StatementKind::WHILE:
+                    // Whatever an iteration reads is live at the end of the previous one. That over-approximates
+                    // the liveness fixpoint in one pass, the loop itself stays even when its body ends up empty.
+                    use(statement.expression);
+                    useScope(statement.scope);
+                    eliminateConditionalScope(statement.scope);
+                    use(statement.expression);
+                    return true;
+            }
+            return true;
+        }
+};
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <unordered_map>
+#include "instructions.hpp"
+#include "diagnostics.hpp"
+
+using namespace std;
+
+// Turns the generator's instructions into x86-64 machine code.
+// Jumps are encoded with 32 bit displacements that are patched once every label is known.
+class Encoder {
+    public:
+        inline explicit Encoder(const vector<Instruction>& instructions): _instructions(instructions) { }
+
+        [[nodiscard]] vector<uint8_t> encode() {
+            for(const Instruction& instruction : _instructions) encodeInstruction(instruction);
+            for(const Fixup& fixup : _fixups) {
+                auto it = _labels.find(fixup.label);
+                if(it == _labels.end()) fail("undefined label `" + fixup.label + "`");
+                int32_t displacement = static_cast<int32_t>(it->second - (fixup.offset + 4));
+                memcpy(_code.data() + fixup.offset, &displacement, 4);
+            }
+            return move(_code);
+        }
+
+        [[nodiscard]] size_t labelOffset(const string& label) const { return _labels.at(label); }
+
+    private:
+        const vector<Instruction>& _instructions;
+        vector<uint8_t> _code {};
+        unordered_map<string, size_t> _labels {};
+        struct Fixup { size_t offset; string label; };
+        vector<Fixup> _fixups {};
+
+        // opcodes of the two operand ALU instructions: `op r/m, r`, `op r, r/m` and the /digit of `op r/m, imm`
+        struct AluOpcodes { uint8_t toMemory; uint8_t fromMemory; uint8_t extension; };
+
+        [[noreturn]] static void fail(const string& message) {
+            throw CompileError(0, "Internal Error: Cannot encode instruction, ", message, ".");
+        }
+
+        static int code(Register reg) { return static_cast<int>(reg); }
+        static bool fitsInt8(int64_t value) { return value >= INT8_MIN && value <= INT8_MAX; }
+        static bool fitsInt32(int64_t value) { return value >= INT32_MIN && value <= INT32_MAX; }
+
+        void byte(uint8_t value) { _code.push_back(value); }
+
+        void int32(int32_t value) {
+            uint8_t bytes[4];
+            memcpy(bytes, &value, 4);
+            _code.insert(_code.end(), bytes, bytes + 4);
+        }
+
+        void int64(uint64_t value) {
+            uint8_t bytes[8];
+            memcpy(bytes, &value, 8);
+            _code.insert(_code.end(), bytes, bytes + 8);
+        }
+
+        // REX prefix for a ModRM encoded instruction, `rm` is either a register or the base of a memory operand.
+        void rex(bool wide, int reg, int rm, int index = 0) {
+            uint8_t prefix = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((index & 8) ? 0x02 : 0) | ((rm & 8) ? 0x01 : 0);
+            if(prefix != 0x40) byte(prefix);
+        }
+
+        static int rmCode(const Operand& operand) {
+            if(auto reg = get_if<Register>(&operand)) return code(*reg);
+            return code(get<Memory>(operand).base);
+        }
+
+        static int indexCode(const Operand& operand) {
+            auto memory = get_if<Memory>(&operand);
+            return memory != nullptr && memory->index.has_value() ? code(*memory->index) : 0;
+        }
+
+        void modrm(int reg, const Operand& rm) {
+            if(auto target = get_if<Register>(&rm)) {
+                byte(0xC0 | ((reg & 7) << 3) | (code(*target) & 7));
+                return;
+            }
+            const Memory& memory = get<Memory>(rm);
+            int base = code(memory.base) & 7;
+            uint8_t mod = memory.offset == 0 && base != 5 ? 0x00 : fitsInt8(memory.offset) ? 0x40 : 0x80; // rbp/r13 always need a displacement
+            if(memory.index.has_value()) {
+                if(*memory.index == Register::RSP) fail("rsp cannot be an index");
+                uint8_t scale = memory.scale == 8 ? 3 : memory.scale == 4 ? 2 : memory.scale == 2 ? 1 : 0;
+                byte(mod | ((reg & 7) << 3) | 4);
+                byte((scale << 6) | ((code(*memory.index) & 7) << 3) | base);
+            } else {
+                byte(mod | ((reg & 7) << 3) | base);
+                if(base == 4) byte(0x24); // rsp/r12 need a SIB byte
+            }
+            if(mod == 0x40) byte(static_cast<uint8_t>(memory.offset));
+            else if(mod == 0x80) int32(memory.offset);
+        }
+
+        // REX.W + opcode + ModRM for `opcode rm, reg` style instructions.
+        void wideModrm(vector<uint8_t> opcode, int reg, const Operand& rm) {
+            rex(true, reg, rmCode(rm), indexCode(rm));
+            for(uint8_t value : opcode) byte(value);
+            modrm(reg, rm);
+        }
+
+        void alu(const Instruction& instruction, AluOpcodes opcodes) {
+            const Operand& destination = instruction.operands.at(0);
+            const Operand& source = instruction.operands.at(1);
+            if(auto immediate = get_if<Immediate>(&source)) {
+                int64_t value = static_cast<int64_t>(immediate->value);
+                if(!fitsInt32(value)) fail("immediate does not fit in 32 bits");
+                wideModrm({ static_cast<uint8_t>(fitsInt8(value) ? 0x83 : 0x81) }, opcodes.extension, destination);
+                if(fitsInt8(value)) byte(static_cast<uint8_t>(value));
+                else int32(static_cast<int32_t>(value));
+            } else if(auto reg = get_if<Register>(&source)) {
+                wideModrm({ opcodes.toMemory }, code(*reg), destination);
+            } else if(auto reg = get_if<Register>(&destination)) {
+                wideModrm({ opcodes.fromMemory }, code(*reg), source);
+            } else {
+                fail("both operands are memory");
+            }
+        }
+
+        void mov(const Instruction& instruction) {
+            const Operand& destination = instruction.operands.at(0);
+            const Operand& source = instruction.operands.at(1);
+            auto immediate = get_if<Immediate>(&source);
+            if(immediate != nullptr && holds_alternative<Register>(destination)) {
+                int reg = code(get<Register>(destination));
+                if(immediate->value <= UINT32_MAX) {
+                    rex(false, 0, reg); // 32 bit moves zero the upper half
+                    byte(0xB8 + (reg & 7));
+                    int32(static_cast<int32_t>(immediate->value));
+                } else if(fitsInt32(static_cast<int64_t>(immediate->value))) {
+                    wideModrm({ 0xC7 }, 0, destination);
+                    int32(static_cast<int32_t>(immediate->value));
+                } else {
+                    rex(true, 0, reg);
+                    byte(0xB8 + (reg & 7));
+                    int64(immediate->value);
+                }
+            } else if(immediate != nullptr) {
+                if(!fitsInt32(static_cast<int64_t>(immediate->value))) fail("immediate does not fit in 32 bits");
+                wideModrm({ 0xC7 }, 0, destination);
+                int32(static_cast<int32_t>(immediate->value));
+            } else {
+                alu(instruction, { .toMemory = 0x89, .fromMemory = 0x8B, .extension = 0 });
+            }
+        }
+
+        void jump(const vector<uint8_t>& opcode, const Operand& target) {
+            for(uint8_t value : opcode) byte(value);
+            _fixups.push_back({.offset = _code.size(), .label = get<Label>(target).name});
+            int32(0);
+        }
+
+        void encodeInstruction(const Instruction& instruction) {
+            switch(instruction.opcode) {
+                case Opcode::LABEL:
+                    _labels[get<Label>(instruction.operands.at(0)).name] = _code.size();
+                    break;
+                case Opcode::MOV:
+                    mov(instruction);
+                    break;
+                case Opcode::PUSH: {
+                    const Operand& source = instruction.operands.at(0);
+                    if(auto reg = get_if<Register>(&source)) {
+                        rex(false, 0, code(*reg));
+                        byte(0x50 + (code(*reg) & 7));
+                    } else if(auto immediate = get_if<Immediate>(&source)) {
+                        int64_t value = static_cast<int64_t>(immediate->value);
+                        if(!fitsInt32(value)) fail("immediate does not fit in 32 bits");
+                        if(fitsInt8(value)) {
+                            byte(0x6A);
+                            byte(static_cast<uint8_t>(value));
+                        } else {
+                            byte(0x68);
+                            int32(static_cast<int32_t>(value));
+                        }
+                    } else {
+                        rex(false, 6, rmCode(source));
+                        byte(0xFF);
+                        modrm(6, source);
+                    }
+                    break;
+                }
+                case Opcode::POP: {
+                    const Operand& destination = instruction.operands.at(0);
+                    if(auto reg = get_if<Register>(&destination)) {
+                        rex(false, 0, code(*reg));
+                        byte(0x58 + (code(*reg) & 7));
+                    } else {
+                        rex(false, 0, rmCode(destination));
+                        byte(0x8F);
+                        modrm(0, destination);
+                    }
+                    break;
+                }
+                case Opcode::ADD:
+                    alu(instruction, { .toMemory = 0x01, .fromMemory = 0x03, .extension = 0 });
+                    break;
+                case Opcode::SUB:
+                    alu(instruction, { .toMemory = 0x29, .fromMemory = 0x2B, .extension = 5 });
+                    break;
+                case Opcode::XOR:
+                    alu(instruction, { .toMemory = 0x31, .fromMemory = 0x33, .extension = 6 });
+                    break;
+                case Opcode::CMP:
+                    alu(instruction, { .toMemory = 0x39, .fromMemory = 0x3B, .extension = 7 });
+                    break;
+                case Opcode::IMUL: {
+                    const Operand& destination = instruction.operands.at(0);
+                    if(!holds_alternative<Register>(destination)) fail("imul needs a register destination");
+                    if(instruction.operands.size() == 3) { // imul reg, r/m, imm
+                        int64_t value = static_cast<int64_t>(get<Immediate>(instruction.operands.at(2)).value);
+                        if(!fitsInt32(value)) fail("immediate does not fit in 32 bits");
+                        wideModrm({ static_cast<uint8_t>(fitsInt8(value) ? 0x6B : 0x69) }, code(get<Register>(destination)), instruction.operands.at(1));
+                        if(fitsInt8(value)) byte(static_cast<uint8_t>(value));
+                        else int32(static_cast<int32_t>(value));
+                    } else {
+                        wideModrm({ 0x0F, 0xAF }, code(get<Register>(destination)), instruction.operands.at(1));
+                    }
+                    break;
+                }
+                case Opcode::DIV:
+                    wideModrm({ 0xF7 }, 6, instruction.operands.at(0));
+                    break;
+                case Opcode::MUL:
+                    wideModrm({ 0xF7 }, 4, instruction.operands.at(0));
+                    break;
+                case Opcode::SHL:
+                case Opcode::SHR: {
+                    uint64_t count = get<Immediate>(instruction.operands.at(1)).value;
+                    if(count > 63) fail("shift count does not fit in 6 bits");
+                    wideModrm({ static_cast<uint8_t>(count == 1 ? 0xD1 : 0xC1) }, instruction.opcode == Opcode::SHL ? 4 : 5, instruction.operands.at(0));
+                    if(count != 1) byte(static_cast<uint8_t>(count));
+                    break;
+                }
+                case Opcode::LEA: {
+                    const Operand& destination = instruction.operands.at(0);
+                    if(!holds_alternative<Register>(destination) || !holds_alternative<Memory>(instruction.operands.at(1))) fail("lea needs a register and an address");
+                    wideModrm({ 0x8D }, code(get<Register>(destination)), instruction.operands.at(1));
+                    break;
+                }
+                case Opcode::JE:
+                    jump({ 0x0F, 0x84 }, instruction.operands.at(0));
+                    break;
+                case Opcode::JNE:
+                    jump({ 0x0F, 0x85 }, instruction.operands.at(0));
+                    break;
+                case Opcode::JMP:
+                    jump({ 0xE9 }, instruction.operands.at(0));
+                    break;
+                case Opcode::CALL:
+                    jump({ 0xE8 }, instruction.operands.at(0));
+                    break;
+                case Opcode::SYSCALL:
+                    byte(0x0F);
+                    byte(0x05);
+                    break;
+                case Opcode::RET:
+                    byte(0xC3);
+                    break;
+            }
+        }
+};
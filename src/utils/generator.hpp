@@ -1,224 +1,601 @@
 #pragma once
 
 #include <iostream>
-#include <sstream>
 #include <vector>
-#include <algorithm>
+#include <unordered_map>
+#include <utility>
 #include "parser.hpp"
+#include "registers.hpp"
+#include "instructions.hpp"
+#include "arithmetic.hpp"
+#include "profile.hpp"
 
 using namespace std;
 
+// EXECUTABLE code starts at `_start` and leaves through the exit syscall,
+// FUNCTION code is a System V function returning the exit value, for running it in-process.
+enum class Target { EXECUTABLE, FUNCTION };
+
+// Functions follow the System V convention: arguments in rdi, rsi, rdx, rcx, r8 and r9, the result in rax, rbx, rbp
+// and r12 to r15 preserved and the stack 16 byte aligned at every call. Their code is placed after the program's,
+// only for functions that are still called.
+// With an Instrumentation every if and while counts into its block, and an executable writes the profile on exit.
+// With a Profile, branches that mostly skip their scope have it moved behind the program's end, so the path
+// that is usually taken runs straight through.
 class Generator {
     public:
-        inline explicit Generator(NodeProgram program): _program(move(program)) { }
-        bool _hasExplicitExit = false;
+        inline explicit Generator(const NodeProgram& program, Target target = Target::EXECUTABLE, Instrumentation* instrumentation = nullptr, const Profile* profile = nullptr):
+            _program(program), _target(target), _instrumentation(instrumentation), _profile(profile), _registers(
+            { Register::RBX, Register::RCX, Register::RSI, Register::RDI, Register::R8, Register::R9,
+              Register::R10, Register::R11, Register::R12, Register::R13, Register::R14, Register::R15 },
+            [this](Register reg) { push(reg); }, // spill
+            [this](Register reg) { pop(reg); } // reload
+        ) { }
+
+        RegisterAllocator::Temp generateExpression(NodeIndex index) {
+            if(!_hoisted.empty()) {
+                if(auto it = _hoisted.find(index); it != _hoisted.end()) {
+                    RegisterAllocator::Temp temp = _registers.allocate();
+                    emit(Opcode::MOV, { _registers.ensure(temp), it->second }); // computed before the loop
+                    return temp;
+                }
+            }
+            const NodeExpression& expression = _program.expression(index);
+            switch(expression.kind) {
+                case ExpressionKind::NUMBER: {
+                    RegisterAllocator::Temp temp = _registers.allocate();
+                    emit(Opcode::MOV, { _registers.ensure(temp), Immediate{expression.value} }); // move the number to a register
+                    return temp;
+                }
+                case ExpressionKind::IDENTIFIER: {
+                    const Var* var = _vars.find(expression.symbol);
+                    if(var == nullptr) {
+                        throw CompileError(expression.line, "Invalid Syntax: Identifier `", _program.name(expression.symbol), "` does not exist at line ", expression.line, ".");
+                    }
+                    RegisterAllocator::Temp temp = _registers.allocate(); // allocate first, a spill moves the stack
+                    if(var->reg.has_value()) emit(Opcode::MOV, { _registers.ensure(temp), *var->reg }); // copy the variable kept in a register by a loop
+                    else emit(Opcode::MOV, { _registers.ensure(temp), varOffset(*var) }); // load the variable
+                    return temp;
+                }
+                case ExpressionKind::CALL:
+                    return generateCall(expression);
+                case ExpressionKind::ADD:
+                    return generateArithmetic(Opcode::ADD, expression);
+                case ExpressionKind::SUBTRACT:
+                    return generateArithmetic(Opcode::SUB, expression);
+                case ExpressionKind::MULTIPLY: {
+                    const NodeExpression& left = _program.expression(expression.left());
+                    const NodeExpression& right = _program.expression(expression.right());
+                    if(right.kind == ExpressionKind::NUMBER) return generateMultiplyByConstant(expression.left(), right.value);
+                    if(left.kind == ExpressionKind::NUMBER) return generateMultiplyByConstant(expression.right(), left.value);
+                    return generateArithmetic(Opcode::IMUL, expression);
+                }
+                case ExpressionKind::DIVIDE: {
+                    const NodeExpression& right = _program.expression(expression.right());
+                    if(right.kind == ExpressionKind::NUMBER && right.value != 0) return generateDivideByConstant(expression.left(), right.value); // dividing by zero keeps its trap
+                    break;
+                }
+            }
+            auto [left, right] = generateOperands(expression.left(), expression.right());
+            Register dividend = _registers.ensure(left);
+            emit(Opcode::MOV, { Register::RAX, dividend }); // move the dividend into rax
+            emit(Opcode::XOR, { Register::RDX, Register::RDX }); // zero RDX for division
+            emit(Opcode::DIV, { _registers.ensure(right) }); // divide rax by the divisor
+            emit(Opcode::MOV, { dividend, Register::RAX }); // move the quotient back
+            _registers.release(right);
+            return left;
+        }
 
-        void generateTerm(const NodeTerm* term) {
-            struct TermVisitor {
-                Generator* generator;
+        void generateScope(NodeIndex scope) {
+            beginScope();
+            for(NodeIndex statement : _program.body(scope)) generateStatement(statement);
+            endScope();
+        }
 
-                void operator()(const NodeTermNumber* number) const {
-                    generator->_out << "    mov rax, " << number->number.value << "\n"; // move the number to rax
-                    generator->push("rax"); // push the value onto the stack
+        void generateStatement(NodeIndex index) {
+            const NodeStatement& statement = _program.statement(index);
+            switch(statement.kind) {
+                case StatementKind::EXIT: {
+                    RegisterAllocator::Temp value = generateExpression(statement.expression);
+                    Register reg = _registers.ensure(value);
+                    _registers.release(value);
+                    generateExit(reg);
+                    break;
                 }
-
-                void operator()(const NodeTermIdentifier* identifier) const {
-                    auto it = find_if(generator->_vars.cbegin(), generator->_vars.cend(), [&](const Var& var) {
-                        return var.name == identifier->identifier.value;
-                    });
-                    if(it == generator->_vars.cend()) {
-                        cerr << "Invalid Syntax: Identifier `" << identifier->identifier.value << "` does not exist at line " << identifier->identifier.line << "." << endl;
-                        exit(EXIT_FAILURE);
+                case StatementKind::LET: {
+                    if(_vars.find(statement.symbol) != nullptr) {
+                        throw CompileError(statement.line, "Identifier `", _program.name(statement.symbol), "` already exists at line ", statement.line, ".");
                     }
-                    stringstream offset;
-                    offset << "QWORD [rsp + " << (generator->_stackSize - (*it).stackPos - 1) * 8 << "]";
-                    generator->push(offset.str()); // push the value onto the stack
+                    RegisterAllocator::Temp value = generateExpression(statement.expression);
+                    push(_registers.ensure(value)); // the pushed value becomes the variable's slot
+                    _registers.release(value);
+                    _vars.declare(statement.symbol, {.stackPos = _stackSize - 1});
+                    break;
                 }
-
-                void operator()(const NodeTermParentheses* parentheses) const {
-                    generator->generateExpression(parentheses->expression);
+                case StatementKind::ASSIGNMENT: {
+                    const Var* var = _vars.find(statement.symbol);
+                    if(var == nullptr) {
+                        throw CompileError(statement.line, "Identifier `", _program.name(statement.symbol), "` does not exist at line ", statement.line, "!");
+                    }
+                    RegisterAllocator::Temp value = generateExpression(statement.expression);
+                    Register reg = _registers.ensure(value);
+                    if(var->reg.has_value()) emit(Opcode::MOV, { *var->reg, reg });
+                    else emit(Opcode::MOV, { varOffset(*var), reg }); // store the value in the variable
+                    _registers.release(value);
+                    break;
                 }
-            };
+                case StatementKind::SCOPE:
+                    generateScope(statement.scope);
+                    break;
+                case StatementKind::IF: {
+                    optional<size_t> branch = countReached(statement);
+                    string label = createLabel();
+                    RegisterAllocator::Temp condition = generateExpression(statement.expression);
+                    emit(Opcode::CMP, { _registers.ensure(condition), Immediate{0} }); // compare the condition result
+                    _registers.release(condition);
+                    if(isCold(statement)) {
+                        // the condition is inverted, the scope jumps back after running out of line
+                        string cold = createLabel();
+                        emit(Opcode::JNE, { Label{cold} });
+                        vector<Instruction> instructions = exchange(_instructions, {});
+                        emit(Opcode::LABEL, { Label{cold} });
+                        countTaken(branch);
+                        generateScope(statement.scope);
+                        emit(Opcode::JMP, { Label{label} });
+                        outline(exchange(_instructions, move(instructions)));
+                    } else {
+                        emit(Opcode::JE, { Label{label} }); // jump to label
+                        countTaken(branch);
+                        generateScope(statement.scope); // generate the scope if condition is true
+                    }
+                    emit(Opcode::LABEL, { Label{label} }); // label for the end of the if statement
+                    break;
+                }
+                case StatementKind::ELSE: {
+                    string label = createLabel();
+                    emit(Opcode::JMP, { Label{label} }); // jump to the end of the else
+                    emit(Opcode::LABEL, { Label{label} }); // label for the end of the else statement
+                    generateScope(statement.scope); // generate the scope for else
+                    break;
+                }
+                case StatementKind::WHILE:
+                    generateWhile(statement);
+                    break;
+                case StatementKind::RETURN: {
+                    RegisterAllocator::Temp value = generateExpression(statement.expression);
+                    Register reg = _registers.ensure(value);
+                    _registers.release(value);
+                    generateReturn(reg);
+                    break;
+                }
+                case StatementKind::FUNCTION:
+                    generateFunction(statement);
+                    break;
+            }
+        }
 
-            TermVisitor visitor{.generator = this};
-            visit(visitor, term->var);
+        [[nodiscard]] vector<Instruction> generateProgram() {
+            for(NodeIndex index : _program.body(_program.root)) {
+                const NodeStatement& statement = _program.statement(index);
+                if(statement.kind != StatementKind::FUNCTION) continue;
+                _functions.try_emplace(statement.symbol, Function{.label = "fn_" + string(_program.name(statement.symbol)), .arity = _program.functions[statement.function].count});
+            }
+            emit(Opcode::LABEL, { Label{"_start"} });
+            if(_target == Target::FUNCTION) {
+                for(Register reg : calleeSaved) emit(Opcode::PUSH, { reg }); // the allocator hands these out too
+                emit(Opcode::MOV, { Register::RBP, Register::RSP }); // remember the frame to unwind on exit
+                _frameWords = 1 + size(calleeSaved); // the return address and the pushes, an odd number
+            }
+
+            for(NodeIndex statement : _program.body(_program.root)) generateStatement(statement);
+            generateExit(Immediate{0}); // an exit inside an if or while may not run, the end of the code must not be reached
+            _instructions.insert(_instructions.end(), make_move_iterator(_cold.begin()), make_move_iterator(_cold.end()));
+            if(_instrumentation != nullptr && _target == Target::EXECUTABLE) generateProfileWriter();
+
+            // the functions the program calls, and those they call in turn
+            vector<uint32_t> pending = move(_calls);
+            while(!pending.empty()) {
+                Function& function = _functions.at(pending.back());
+                pending.pop_back();
+                if(function.placed) continue;
+                function.placed = true;
+                _instructions.insert(_instructions.end(), make_move_iterator(function.code.begin()), make_move_iterator(function.code.end()));
+                pending.insert(pending.end(), function.calls.begin(), function.calls.end());
+            }
+            return move(_instructions);
         }
 
-        void generateBinaryExpression(const BinaryExpression* binaryExpression) {
-            struct BinaryExpressionVisitor {
-                Generator* generator;
+        // Scopes moved out of line after the profile.
+        [[nodiscard]] inline size_t outlined() const { return _outlined; }
 
-                void operator()(const BinaryExpressionAdd* add) const {
-                    generator->generateExpression(add->left);
-                    generator->generateExpression(add->right);
-                    generator->pop("rax"); // pop the right operand into rax
-                    generator->pop("rbx"); // pop the left operand into rbx
-                    generator->_out << "    add rax, rbx\n"; // add the two operands
-                    generator->push("rax"); // push the result onto the stack
-                }
+    private:
+        static constexpr Register calleeSaved[] = { Register::RBX, Register::RBP, Register::R12, Register::R13, Register::R14, Register::R15 };
+        static constexpr Register argumentRegisters[] = { Register::RDI, Register::RSI, Register::RDX, Register::RCX, Register::R8, Register::R9 };
+
+        struct Function {
+            string label;
+            uint32_t arity;
+            bool generated = false;
+            bool placed = false;
+            vector<Instruction> code {};
+            vector<uint32_t> calls {}; // the functions its code calls
+        };
+
+        const NodeProgram& _program;
+        Target _target;
+        Instrumentation* _instrumentation;
+        const Profile* _profile;
+        vector<Instruction> _instructions {};
+        vector<Instruction> _cold {}; // scopes that rarely run, placed after the program
+        size_t _outlined = 0;
+        string _profileWriter {}; // label of the routine an instrumented executable exits through
+        unordered_map<uint32_t, Function> _functions {}; // by name, the first definition of each
+        vector<uint32_t> _calls {}; // functions called by the code being generated
+        string _returnLabel {}; // the epilogue of the function being generated
+        size_t _frameWords = 0; // words pushed between the last 16 byte aligned stack pointer and the first variable
+        size_t _stackSize = 0;
+        size_t _labelCount = 0; // per instance so generators on different threads never share state
+        struct Var { size_t stackPos; optional<Register> reg {}; }; // `reg` holds the value instead of the slot inside a loop
+        ScopedSymbolTable<Var> _vars {};
+        RegisterAllocator _registers;
+        unordered_map<NodeIndex, Register> _hoisted {}; // loop invariant expressions and the registers holding their value
 
-                void operator()(const BinaryExpressionSubtract* subtract) const {
-                    generator->generateExpression(subtract->left);
-                    generator->generateExpression(subtract->right);
-                    generator->pop("rax"); // pop the right operand into rax
-                    generator->pop("rbx"); // pop the left operand into rbx
-                    generator->_out << "    sub rbx, rax\n"; // subtract the two operands
-                    generator->push("rbx"); // push the result onto the stack
-                }
+        static constexpr size_t temporaryRegisters = 6; // never reserved by loops, so expressions keep room to work in
 
-                void operator()(const BinaryExpressionMultiply* multiply) const {
-                    generator->generateExpression(multiply->left);
-                    generator->generateExpression(multiply->right);
-                    generator->pop("rax"); // pop the right operand into rax
-                    generator->pop("rbx"); // pop the left operand into rbx
-                    generator->_out << "    mul rbx\n"; // multiply the two operands
-                    generator->push("rax"); // push the result onto the stack
-                }
+        void emit(Opcode opcode, vector<Operand> operands = {}) {
+            _instructions.push_back({.opcode = opcode, .operands = move(operands)});
+        }
 
-                void operator()(const BinaryExpressionDivide* divide) const {
-                    generator->generateExpression(divide->left);
-                    generator->generateExpression(divide->right);
-                    generator->pop("rbx"); // pop the right operand (divisor) into rbx
-                    generator->pop("rax"); // pop the left operand (dividend) into rax
-                    generator->_out << "    xor rdx, rdx\n"; // zero RDX for division
-                    generator->_out << "    div rbx\n"; // divide rax by rbx
-                    generator->push("rax"); // push the result onto the stack
-                }
-            };
+        // Generates both operands of a binary expression, the right one is always left in a register.
+        pair<RegisterAllocator::Temp, RegisterAllocator::Temp> generateOperands(NodeIndex left, NodeIndex right) {
+            RegisterAllocator::Temp leftTemp = generateExpression(left);
+            RegisterAllocator::Temp rightTemp = generateExpression(right);
+            _registers.ensure(rightTemp);
+            _registers.ensure(leftTemp);
+            return { leftTemp, rightTemp };
+        }
 
-            BinaryExpressionVisitor visitor{.generator = this};
-            visit(visitor, binaryExpression->var);
+        // add, sub and imul all take the left operand as their destination
+        RegisterAllocator::Temp generateArithmetic(Opcode opcode, const NodeExpression& expression) {
+            auto [left, right] = generateOperands(expression.left(), expression.right());
+            emit(opcode, { _registers.ensure(left), _registers.ensure(right) });
+            _registers.release(right);
+            return left;
         }
 
-        void generateExpression(const NodeExpression* expression) {
-            struct ExpressionVisitor {
-                Generator* generator;
+        // Loops are rotated, the condition is tested at the bottom so an iteration takes a single branch. For the
+        // duration of the loop the outer variables it assigns live in registers instead of their stack slots,
+        // and pure expressions over variables it never assigns are computed once before it.
+        void generateWhile(const NodeStatement& statement) {
+            vector<uint32_t> assigned;
+            collectAssignments(_program, statement.scope, assigned);
+            vector<uint32_t> promoted = promoteVariables(assigned);
+            vector<NodeIndex> hoisted = hoistInvariants(statement, assigned);
+
+            // the test is generated first, so errors are reported in source order, and placed after the body
+            optional<size_t> branch = countReached(statement);
+            string body = createLabel(), test = createLabel();
+            vector<Instruction> instructions = exchange(_instructions, {});
+            emit(Opcode::LABEL, { Label{test} });
+            RegisterAllocator::Temp condition = generateExpression(statement.expression);
+            emit(Opcode::CMP, { _registers.ensure(condition), Immediate{0} });
+            _registers.release(condition);
+            emit(Opcode::JNE, { Label{body} }); // loop while the condition holds
+            vector<Instruction> bottom = exchange(_instructions, move(instructions));
+
+            if(isCold(statement)) {
+                // the loop mostly exits right away, so the test leads and the body runs out of line
+                _instructions.insert(_instructions.end(), make_move_iterator(bottom.begin()), make_move_iterator(bottom.end()));
+                instructions = exchange(_instructions, {});
+                emit(Opcode::LABEL, { Label{body} });
+                countTaken(branch);
+                generateScope(statement.scope);
+                emit(Opcode::JMP, { Label{test} });
+                outline(exchange(_instructions, move(instructions)));
+            } else {
+                emit(Opcode::JMP, { Label{test} }); // enter at the test
+                emit(Opcode::LABEL, { Label{body} });
+                countTaken(branch);
+                generateScope(statement.scope);
+                _instructions.insert(_instructions.end(), make_move_iterator(bottom.begin()), make_move_iterator(bottom.end()));
+            }
 
-                void operator()(const NodeTerm* term) const {
-                    generator->generateTerm(term);
-                }
+            for(size_t i = hoisted.size(); i > 0; i--) {
+                _registers.unreserve(_hoisted.at(hoisted[i - 1]));
+                _hoisted.erase(hoisted[i - 1]);
+            }
+            for(size_t i = promoted.size(); i > 0; i--) {
+                Var* var = _vars.find(promoted[i - 1]);
+                emit(Opcode::MOV, { varOffset(*var), *var->reg }); // write the final value back to the slot
+                _registers.unreserve(*var->reg);
+                var->reg.reset();
+            }
+        }
 
-                void operator()(const BinaryExpression* binaryExpression) const {
-                    generator->generateBinaryExpression(binaryExpression);
-                }
-            };
+        // Loads the assigned variables declared before the loop into registers while registers are left, returns them.
+        vector<uint32_t> promoteVariables(const vector<uint32_t>& assigned) {
+            vector<uint32_t> promoted;
+            for(uint32_t symbol : assigned) {
+                Var* var = _vars.find(symbol);
+                if(var == nullptr || var->reg.has_value()) continue; // declared inside the loop, or already in a register
+                optional<Register> reg = _registers.reserve(temporaryRegisters);
+                if(!reg.has_value()) break;
+                emit(Opcode::MOV, { *reg, varOffset(*var) });
+                var->reg = reg;
+                promoted.push_back(symbol);
+            }
+            return promoted;
+        }
 
-            ExpressionVisitor visitor{.generator = this};
-            visit(visitor, expression->var);
+        // Computes the loop's invariant expressions into registers while registers are left, returns them.
+        vector<NodeIndex> hoistInvariants(const NodeStatement& loop, const vector<uint32_t>& assigned) {
+            vector<bool> varies(_program.names.size(), false);
+            for(uint32_t symbol : assigned) varies[symbol] = true;
+            vector<NodeIndex> candidates;
+            findInvariants(loop.expression, varies, candidates);
+            findInvariantsInScope(loop.scope, varies, candidates);
+
+            vector<NodeIndex> hoisted;
+            for(NodeIndex index : candidates) {
+                optional<Register> reg = _registers.reserve(temporaryRegisters);
+                if(!reg.has_value()) break;
+                RegisterAllocator::Temp value = generateExpression(index);
+                emit(Opcode::MOV, { *reg, _registers.ensure(value) });
+                _registers.release(value);
+                _hoisted[index] = *reg;
+                hoisted.push_back(index);
+            }
+            return hoisted;
         }
 
-        void generateScope(const NodeScope* scope) {
-            beginScope();
-            for(const NodeStatement* statement : scope->statements) generateStatement(statement);
-            endScope();
+        // Whether the expression only reads variables declared before the loop that the loop never assigns.
+        bool isInvariant(NodeIndex index, const vector<bool>& varies) {
+            const NodeExpression& expression = _program.expression(index);
+            if(expression.kind == ExpressionKind::IDENTIFIER) return _vars.find(expression.symbol) != nullptr && !varies[expression.symbol];
+            if(expression.isBinary()) return isInvariant(expression.left(), varies) && isInvariant(expression.right(), varies);
+            return true;
         }
-        
-        void generateStatement(const NodeStatement* statement) {
-            struct StatementVisitor {
-                Generator* generator;
-                void operator()(const NodeExit* exit) const {
-                    generator->generateExpression(exit->exp);
-                    generator->_out << "    mov rax, 60\n"; // syscall number for exit
-                    generator->pop("rdi"); // pop the top of the stack into rdi
-                    generator->_out << "    syscall\n"; // make the syscall
-                    generator->_hasExplicitExit = true;
-                }
 
-                void operator()(const NodeLet* let) const {
-                    auto it = find_if(generator->_vars.cbegin(), generator->_vars.cend(), [&](const Var& var) {
-                        return var.name == let->identifier.value;
-                    });
-                    if(it != generator->_vars.cend()) {
-                        cerr << "Identifier `" << let->identifier.value << "` already exists at line " << let->identifier.line << "." << endl;
-                        exit(EXIT_FAILURE);
-                    }
-                    generator->_vars.push_back({.name = let->identifier.value, .stackPos = generator->_stackSize});
-                    generator->generateExpression(let->value);
-                }
+        // Collects the largest invariant expressions that cannot trap. Lone numbers and variables are left alone,
+        // loading them costs as much as copying a register.
+        void findInvariants(NodeIndex index, const vector<bool>& varies, vector<NodeIndex>& found) {
+            const NodeExpression& expression = _program.expression(index);
+            if(!expression.isBinary() || _hoisted.contains(index)) return;
+            if(isPure(_program, index) && isInvariant(index, varies)) {
+                found.push_back(index);
+                return;
+            }
+            findInvariants(expression.left(), varies, found);
+            findInvariants(expression.right(), varies, found);
+        }
 
-                void operator()(const NodeAssignment* assignment) const {
-                    auto it = find_if(generator->_vars.cbegin(), generator->_vars.cend(), [&](const Var& var) {
-                        return var.name == assignment->identifier.value;
-                    });
-                    if(it == generator->_vars.cend()) {
-                        cerr << "Identifier `" << assignment->identifier.value << "` does not exist at line " << assignment->identifier.line << "!" << endl;
-                        exit(EXIT_FAILURE);
-                    }
-                    generator->generateExpression(assignment->value);
-                    generator->pop("rax"); // pop the value into rax
-                    generator->_out << "    mov QWORD [rsp + " << (generator->_stackSize - it->stackPos - 1) * 8 << "], rax\n"; // store the value in the variable
-                }
+        void findInvariantsInScope(NodeIndex scope, const vector<bool>& varies, vector<NodeIndex>& found) {
+            for(NodeIndex index : _program.body(scope)) {
+                const NodeStatement& statement = _program.statement(index);
+                if(statement.kind <= StatementKind::RETURN || statement.kind == StatementKind::IF || statement.kind == StatementKind::WHILE) findInvariants(statement.expression, varies, found);
+                if(statement.kind >= StatementKind::SCOPE) findInvariantsInScope(statement.scope, varies, found);
+            }
+        }
 
-                void operator()(const NodeScope* scope) const {
-                    generator->generateScope(scope);
-                }
+        RegisterAllocator::Temp generateMultiplyByConstant(NodeIndex operand, uint64_t factor) {
+            RegisterAllocator::Temp temp = generateExpression(operand); // still evaluated when the factor is 0, it may trap
+            Register reg = _registers.ensure(temp);
+            multiplyByConstant(_instructions, reg, reg, factor);
+            return temp;
+        }
 
-                void operator()(const NodeIf* _if) const {
-                    string label = generator->createLabel();
-                    generator->generateExpression(_if->condition);
-                    generator->pop("rax"); // pop the condition result into rax
-                    generator->_out << "    cmp rax, 0\n"; // compare rax
-                    generator->_out << "    je " << label << "\n"; // jump to label
-                    generator->generateScope(_if->scope); // generate the scope if condition is true
-                    generator->_out << "\n" << label << ":\n"; // label for the end of the if statement
-                }
+        RegisterAllocator::Temp generateDivideByConstant(NodeIndex operand, uint64_t divisor) {
+            RegisterAllocator::Temp temp = generateExpression(operand);
+            Register reg = _registers.ensure(temp);
+            divideByConstant(_instructions, reg, reg, divisor);
+            return temp;
+        }
 
-                void operator()(const NodeElse* _else) const {
-                    string label = generator->createLabel();
-                    generator->_out << "    jmp " << label << "\n"; // jump to the end of the else
-                    generator->_out << "\n" << label << ":\n"; // label for the end of the else statement
-                    generator->generateScope(_else->scope); // generate the scope for else
-                }
-            };
+        [[nodiscard]] Memory varOffset(const Var& var) const {
+            return { .base = Register::RSP, .offset = static_cast<int32_t>((_stackSize - var.stackPos - 1) * 8) };
+        }
+
+        // A call spills the temporaries and saves the reserved registers the callee may change, pushes the arguments
+        // as they are evaluated, left to right, and pops them into the argument registers.
+        RegisterAllocator::Temp generateCall(const NodeExpression& expression) {
+            uint32_t callee = _program.callee(expression);
+            span<const NodeIndex> arguments = _program.argumentsOf(expression);
+            auto it = _functions.find(callee);
+            if(it == _functions.end()) {
+                throw CompileError(expression.line, "Invalid Syntax: Function `", _program.name(callee), "` does not exist at line ", expression.line, ".");
+            }
+            if(it->second.arity != arguments.size()) {
+                throw CompileError(expression.line, "Invalid Syntax: Function `", _program.name(callee), "` takes ", it->second.arity, " arguments but ", arguments.size(), " were given at line ", expression.line, ".");
+            }
+            string label = it->second.label;
+
+            _registers.spillAll();
+            vector<Register> saved;
+            for(Register reg : _registers.occupied()) {
+                if(ranges::find(calleeSaved, reg) == end(calleeSaved)) saved.push_back(reg);
+            }
+            for(Register reg : saved) push(reg);
+            bool pad = (_frameWords + _stackSize) % 2 != 0; // the arguments are popped again before the call
+            if(pad) {
+                emit(Opcode::SUB, { Register::RSP, Immediate{8} });
+                _stackSize++;
+            }
+            for(NodeIndex argument : arguments) {
+                RegisterAllocator::Temp value = generateExpression(argument);
+                push(_registers.ensure(value));
+                _registers.release(value);
+            }
+            for(size_t i = arguments.size(); i > 0; i--) pop(argumentRegisters[i - 1]);
+            emit(Opcode::CALL, { Label{label} });
+            _calls.push_back(callee);
+            if(pad) {
+                emit(Opcode::ADD, { Register::RSP, Immediate{8} });
+                _stackSize--;
+            }
+            for(size_t i = saved.size(); i > 0; i--) pop(saved[i - 1]);
+
+            RegisterAllocator::Temp result = _registers.allocate();
+            emit(Opcode::MOV, { _registers.ensure(result), Register::RAX });
+            return result;
+        }
 
-            StatementVisitor visitor{.generator = this};
-            visit(visitor, statement->var);
+        // Generates the function into a buffer of its own, placed after the program if anything calls it. Its
+        // parameters are pushed into stack slots and are variables like any other, the program's are not visible.
+        void generateFunction(const NodeStatement& statement) {
+            Function& function = _functions.at(statement.symbol);
+            if(function.generated) {
+                throw CompileError(statement.line, "Function `", _program.name(statement.symbol), "` already exists at line ", statement.line, ".");
+            }
+            function.generated = true;
+            vector<Instruction> instructions = exchange(_instructions, {});
+            vector<Instruction> cold = exchange(_cold, {});
+            ScopedSymbolTable<Var> vars = exchange(_vars, {});
+            size_t stackSize = exchange(_stackSize, 0), frameWords = exchange(_frameWords, 0);
+            vector<uint32_t> calls = exchange(_calls, {});
+            string returnLabel = exchange(_returnLabel, createLabel());
+
+            _vars.beginScope();
+            span<const uint32_t> parameters = _program.parametersOf(statement);
+            for(size_t i = 0; i < parameters.size(); i++) {
+                if(_vars.find(parameters[i]) != nullptr) {
+                    throw CompileError(statement.line, "Identifier `", _program.name(parameters[i]), "` already exists at line ", statement.line, ".");
+                }
+                push(argumentRegisters[i]);
+                _vars.declare(parameters[i], {.stackPos = _stackSize - 1});
+            }
+            for(NodeIndex index : _program.body(statement.scope)) generateStatement(index);
+            generateReturn(Immediate{0}); // running off the end returns 0
+            vector<Instruction> body = exchange(_instructions, move(instructions));
+            vector<Instruction> outlined = exchange(_cold, move(cold));
+
+            // only the callee saved registers the body uses are saved, padded to keep the stack aligned
+            vector<Register> saved;
+            for(Register reg : calleeSaved) {
+                auto uses = [&](const Instruction& instruction) {
+                    return ranges::any_of(instruction.operands, [&](const Operand& operand) {
+                        if(auto memory = get_if<Memory>(&operand)) return memory->base == reg || memory->index == reg;
+                        return operand == Operand{reg};
+                    });
+                };
+                if(ranges::any_of(body, uses) || ranges::any_of(outlined, uses)) saved.push_back(reg);
+            }
+            bool pad = (1 + saved.size()) % 2 != 0;
+            vector<Instruction>& code = function.code;
+            code.push_back({.opcode = Opcode::LABEL, .operands = { Label{function.label} }});
+            for(Register reg : saved) code.push_back({.opcode = Opcode::PUSH, .operands = { reg }});
+            if(pad) code.push_back({.opcode = Opcode::SUB, .operands = { Register::RSP, Immediate{8} }});
+            code.insert(code.end(), make_move_iterator(body.begin()), make_move_iterator(body.end()));
+            code.push_back({.opcode = Opcode::LABEL, .operands = { Label{_returnLabel} }});
+            if(pad) code.push_back({.opcode = Opcode::ADD, .operands = { Register::RSP, Immediate{8} }});
+            for(size_t i = saved.size(); i > 0; i--) code.push_back({.opcode = Opcode::POP, .operands = { saved[i - 1] }});
+            code.push_back({.opcode = Opcode::RET});
+            code.insert(code.end(), make_move_iterator(outlined.begin()), make_move_iterator(outlined.end()));
+            function.calls = exchange(_calls, move(calls));
+
+            _vars = move(vars);
+            _stackSize = stackSize;
+            _frameWords = frameWords;
+            _returnLabel = move(returnLabel);
         }
 
-        [[nodiscard]] string generateProgram() {
-            _out << "global _start\n_start:\n"; // initialize the sstream
+        void generateReturn(const Operand& value) {
+            emit(Opcode::MOV, { Register::RAX, value });
+            emit(Opcode::ADD, { Register::RSP, Immediate{_stackSize * 8} }); // drop the parameters and variables
+            emit(Opcode::JMP, { Label{_returnLabel} });
+        }
 
-            for(const NodeStatement* statement : _program.statements) generateStatement(statement);
-            if (!_hasExplicitExit) {
-                _out << "    mov rax, 60\n"; // syscall number for exit
-                _out << "    mov rdi, 0\n"; // move the exit value of 0 to rdi
-                _out << "    syscall\n"; // make the syscall
+        void generateExit(const Operand& value) {
+            if(_target == Target::FUNCTION) {
+                emit(Opcode::MOV, { Register::RAX, value }); // return the exit value
+                emit(Opcode::MOV, { Register::RSP, Register::RBP }); // drop every variable and spill at once
+                for(size_t i = size(calleeSaved); i > 0; i--) emit(Opcode::POP, { calleeSaved[i - 1] });
+                emit(Opcode::RET);
+            } else if(_instrumentation != nullptr) {
+                if(_profileWriter.empty()) _profileWriter = createLabel();
+                emit(Opcode::MOV, { Register::RDI, value });
+                emit(Opcode::JMP, { Label{_profileWriter} }); // exits once the profile is written
+            } else {
+                emit(Opcode::MOV, { Register::RDI, value }); // move the exit value into rdi
+                emit(Opcode::MOV, { Register::RAX, Immediate{60} }); // syscall number for exit
+                emit(Opcode::SYSCALL); // make the syscall
             }
-            return _out.str();
         }
 
-    private:
-        const NodeProgram _program;
-        stringstream _out;
-        size_t _stackSize = 0;
-        struct Var { string name; size_t stackPos; };
-        vector<Var> _vars {};
-        vector<size_t> _scopes {};
+        // Writes the counter block to the profile file and exits with the value in rdi. Failures to write are
+        // ignored, the program still exits with its own value.
+        void generateProfileWriter() {
+            emit(Opcode::LABEL, { Label{_profileWriter} });
+            emit(Opcode::PUSH, { Register::RDI });
+            emit(Opcode::MOV, { Register::RAX, Immediate{2} }); // open
+            emit(Opcode::MOV, { Register::RDI, Immediate{_instrumentation->pathAddress()} });
+            emit(Opcode::MOV, { Register::RSI, Immediate{01101} }); // O_WRONLY | O_CREAT | O_TRUNC
+            emit(Opcode::MOV, { Register::RDX, Immediate{0644} });
+            emit(Opcode::SYSCALL);
+            emit(Opcode::MOV, { Register::RDI, Register::RAX }); // the descriptor, write and close fail on an error
+            emit(Opcode::MOV, { Register::RAX, Immediate{1} }); // write
+            emit(Opcode::MOV, { Register::RSI, Immediate{_instrumentation->address()} });
+            emit(Opcode::MOV, { Register::RDX, Immediate{_instrumentation->size()} });
+            emit(Opcode::SYSCALL);
+            emit(Opcode::MOV, { Register::RAX, Immediate{3} }); // close
+            emit(Opcode::SYSCALL);
+            emit(Opcode::POP, { Register::RDI });
+            emit(Opcode::MOV, { Register::RAX, Immediate{60} });
+            emit(Opcode::SYSCALL);
+        }
+
+        // Adds the branch to the instrumentation and counts reaching it, returns its index.
+        optional<size_t> countReached(const NodeStatement& statement) {
+            if(_instrumentation == nullptr) return {};
+            size_t branch = _instrumentation->addBranch(statement.span.begin);
+            increment(_instrumentation->reachedAddress(branch));
+            return branch;
+        }
+
+        void countTaken(optional<size_t> branch) {
+            if(branch.has_value()) increment(_instrumentation->takenAddress(*branch));
+        }
+
+        void increment(uint64_t address) {
+            emit(Opcode::MOV, { Register::RAX, Immediate{address} });
+            emit(Opcode::ADD, { Memory{.base = Register::RAX, .offset = 0}, Immediate{1} });
+        }
+
+        // Whether the profile saw the if skip its scope more often than run it, or the while enter its body
+        // less than once per time it was reached.
+        bool isCold(const NodeStatement& statement) const {
+            if(_profile == nullptr) return false;
+            const BranchCounts* counts = _profile->find(statement.span.begin);
+            if(counts == nullptr || counts->reached == 0) return false;
+            if(statement.kind == StatementKind::WHILE) return counts->taken < counts->reached;
+            return counts->taken * 2 < counts->reached;
+        }
+
+        void outline(vector<Instruction> instructions) {
+            _cold.insert(_cold.end(), make_move_iterator(instructions.begin()), make_move_iterator(instructions.end()));
+            _outlined++;
+        }
 
-        void push(const string& reg) {
-            _out << "    push " << reg << "\n"; // push the register onto the stack
+        void push(Register reg) {
+            emit(Opcode::PUSH, { reg }); // push the register onto the stack
             _stackSize++;
         }
 
-        void pop(const string& reg) {
-            _out << "    pop " << reg << "\n"; // pop the top of the stack into the register
+        void pop(Register reg) {
+            emit(Opcode::POP, { reg }); // pop the top of the stack into the register
             _stackSize--;
         }
 
         void beginScope() {
-            _scopes.push_back(_vars.size());
+            _vars.beginScope();
         }
 
         void endScope() {
-            size_t count = _vars.size() - _scopes.back();
-            _out << "    add rsp, " << count * 8 << "\n";
+            size_t count = _vars.endScope();
+            emit(Opcode::ADD, { Register::RSP, Immediate{count * 8} });
             _stackSize -= count;
-            _vars.erase(_vars.begin() + _scopes.back(), _vars.end());
-            _scopes.pop_back();
         }
 
         string createLabel() {
-            static size_t labelCount = 0;
-            return "label_" + to_string(labelCount++);
+            return "label_" + to_string(_labelCount++);
         }
-};
\ No newline at end of file
+};
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <unordered_map>
+#include <optional>
+#include "ir.hpp"
+
+using namespace std;
+
+// Global value numbering over the dominator tree: an operation on the same values as one in a dominating block
+// reuses its result, constant operations are folded and identities like x + 0 or x * 1 become copies of x,
+// which every use then reads directly. Branches on constants become jumps and values nothing reads are dropped,
+// divisions that may trap stay.
+class ValueNumbering {
+    public:
+        inline explicit ValueNumbering(IrFunction& function): _function(function) { }
+
+        // Returns the number of values removed.
+        size_t run() {
+            _function.foldBranches();
+            _function.removeUnreachable();
+            _function.simplifyPhis();
+            // a walk folds what it can reach, another one only follows when phis fed from behind, by a loop
+            // or by a removed block, became trivial after it
+            bool changed = true;
+            while(changed) {
+                computeDominators();
+                number();
+                _function.removeUnreachable();
+                changed = _function.simplifyPhis();
+                changed |= _function.foldBranches();
+            }
+            _function.canonicalize();
+            removeDead();
+            return _removed;
+        }
+
+    private:
+        struct Key {
+            IrOp op;
+            ValueId left, right;
+            bool operator==(const Key&) const = default;
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const {
+                return (static_cast<size_t>(key.op) * 0x9E3779B97F4A7C15ULL) ^ (static_cast<size_t>(key.left) << 32 | key.right);
+            }
+        };
+
+        static constexpr BlockId none = UINT32_MAX;
+
+        IrFunction& _function;
+        vector<BlockId> _order {}; // reverse postorder from the entry
+        vector<BlockId> _dominator {}; // by block, its immediate dominator
+        vector<vector<BlockId>> _dominated {}; // by block, the blocks it immediately dominates
+        size_t _removed = 0;
+
+        // Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm".
+        void computeDominators() {
+            size_t count = _function.blocks.size();
+            _order.clear();
+            vector<size_t> position(count, 0);
+            vector<bool> visited(count, false);
+            vector<pair<BlockId, size_t>> stack { { 0, 0 } }; // a block and the next successor to visit
+            visited[0] = true;
+            while(!stack.empty()) {
+                auto& [block, next] = stack.back();
+                const IrBlock& node = _function.blocks[block];
+                if(next < node.successorCount()) {
+                    BlockId successor = node.terminator.targets[next++];
+                    if(!visited[successor]) {
+                        visited[successor] = true;
+                        stack.push_back({ successor, 0 });
+                    }
+                } else {
+                    _order.push_back(block);
+                    stack.pop_back();
+                }
+            }
+            reverse(_order.begin(), _order.end());
+            for(size_t i = 0; i < _order.size(); i++) position[_order[i]] = i;
+
+            _dominator.assign(count, none);
+            _dominator[0] = 0;
+            bool changed = true;
+            while(changed) {
+                changed = false;
+                for(size_t i = 1; i < _order.size(); i++) {
+                    BlockId block = _order[i];
+                    BlockId dominator = none;
+                    for(BlockId predecessor : _function.blocks[block].predecessors) {
+                        if(_dominator[predecessor] == none) continue;
+                        if(dominator == none) {
+                            dominator = predecessor;
+                            continue;
+                        }
+                        BlockId other = predecessor;
+                        while(dominator != other) {
+                            while(position[dominator] > position[other]) dominator = _dominator[dominator];
+                            while(position[other] > position[dominator]) other = _dominator[other];
+                        }
+                    }
+                    if(_dominator[block] != dominator) {
+                        _dominator[block] = dominator;
+                        changed = true;
+                    }
+                }
+            }
+            _dominated.assign(count, {});
+            for(size_t i = 1; i < _order.size(); i++) _dominated[_dominator[_order[i]]].push_back(_order[i]);
+        }
+
+        // Walks the dominator tree keeping the operations of the dominating blocks in a table, undoing a block's
+        // entries once its subtree is done.
+        void number() {
+            unordered_map<Key, ValueId, KeyHash> available;
+            vector<Key> entered;
+            vector<pair<BlockId, size_t>> stack { { 0, 0 } }; // a block and the next dominated block to visit
+            vector<size_t> marks { 0 };
+            numberBlock(0, available, entered);
+            while(!stack.empty()) {
+                auto& [block, next] = stack.back();
+                if(next < _dominated[block].size()) {
+                    BlockId child = _dominated[block][next++];
+                    stack.push_back({ child, 0 });
+                    marks.push_back(entered.size());
+                    numberBlock(child, available, entered);
+                } else {
+                    for(size_t i = marks.back(); i < entered.size(); i++) available.erase(entered[i]);
+                    entered.resize(marks.back());
+                    marks.pop_back();
+                    stack.pop_back();
+                }
+            }
+        }
+
+        void numberBlock(BlockId id, unordered_map<Key, ValueId, KeyHash>& available, vector<Key>& entered) {
+            IrBlock& block = _function.blocks[id];
+            map<vector<ValueId>, ValueId> phis; // phis of one block with the same inputs are the same value
+            for(ValueId phi : block.phis) {
+                if(_function.resolve(phi) != phi) continue;
+                if(_function.trySimplifyPhi(phi) != phi) {
+                    _removed++;
+                    continue;
+                }
+                auto [it, inserted] = phis.try_emplace(_function.values[phi].inputs, phi);
+                if(!inserted) {
+                    _function.replace(phi, it->second);
+                    _removed++;
+                }
+            }
+            for(size_t i = 0; i < block.values.size(); i++) {
+                ValueId value = block.values[i];
+                IrValue& definition = _function.values[value];
+                if(definition.op == IrOp::CONST || _function.resolve(value) != value) continue;
+                ValueId left = definition.operands[0] = _function.resolve(definition.operands[0]);
+                ValueId right = definition.operands[1] = _function.resolve(definition.operands[1]);
+                if(optional<ValueId> simpler = simplify(definition.op, left, right)) {
+                    _function.replace(value, *simpler); // may add a constant to the entry block, `definition` is not used past here
+                    _removed++;
+                    continue;
+                }
+                if((definition.op == IrOp::ADD || definition.op == IrOp::MUL) && left > right) swap(left, right);
+                Key key {.op = definition.op, .left = left, .right = right};
+                auto [it, inserted] = available.try_emplace(key, value);
+                if(inserted) {
+                    entered.push_back(key);
+                } else {
+                    _function.replace(value, it->second);
+                    _removed++;
+                }
+            }
+            _function.foldBranch(id); // the blocks it dominates see the edge gone, their phis simplify when they are visited
+        }
+
+        // Folds operations on constants and applies the identities, division by zero is left to trap.
+        optional<ValueId> simplify(IrOp op, ValueId left, ValueId right) {
+            bool constantLeft = _function.isConstant(left), constantRight = _function.isConstant(right);
+            uint64_t x = _function.values[left].constant, y = _function.values[right].constant;
+            if(constantLeft && constantRight) {
+                switch(op) {
+                    case IrOp::ADD: return _function.constant(x + y);
+                    case IrOp::SUB: return _function.constant(x - y);
+                    case IrOp::MUL: return _function.constant(x * y);
+                    case IrOp::DIV: if(y != 0) return _function.constant(x / y); return {};
+                    default: return {};
+                }
+            }
+            switch(op) {
+                case IrOp::ADD:
+                    if(constantRight && y == 0) return left;
+                    if(constantLeft && x == 0) return right;
+                    break;
+                case IrOp::SUB:
+                    if(constantRight && y == 0) return left;
+                    if(left == right) return _function.constant(0);
+                    break;
+                case IrOp::MUL:
+                    if(constantRight && y == 1) return left;
+                    if(constantLeft && x == 1) return right;
+                    if((constantRight && y == 0) || (constantLeft && x == 0)) return _function.constant(0); // a trapping operand is kept on its own
+                    break;
+                case IrOp::DIV:
+                    if(constantRight && y == 1) return left;
+                    break;
+                default:
+                    break;
+            }
+            return {};
+        }
+
+        // Keeps what terminators read and divisions that may trap, with everything those read in turn.
+        void removeDead() {
+            vector<bool> live(_function.values.size(), false);
+            vector<ValueId> work;
+            auto use = [&](ValueId value) {
+                if(!live[value]) {
+                    live[value] = true;
+                    work.push_back(value);
+                }
+            };
+            for(BlockId id : _function.layout) {
+                const IrBlock& block = _function.blocks[id];
+                if(block.terminator.kind == IrTerminatorKind::BRANCH || block.terminator.kind == IrTerminatorKind::EXIT) use(block.terminator.value);
+                for(ValueId value : block.values) {
+                    if(_function.isTrapping(value)) use(value);
+                }
+            }
+            while(!work.empty()) {
+                const IrValue& definition = _function.values[work.back()];
+                work.pop_back();
+                if(definition.op == IrOp::PHI) {
+                    for(ValueId input : definition.inputs) use(input);
+                } else if(definition.op != IrOp::CONST) {
+                    use(definition.operands[0]);
+                    use(definition.operands[1]);
+                }
+            }
+            for(BlockId id : _function.layout) {
+                IrBlock& block = _function.blocks[id];
+                _removed += erase_if(block.phis, [&](ValueId value) { return !live[value]; });
+                _removed += erase_if(block.values, [&](ValueId value) { return !live[value] && !_function.isConstant(value); });
+                erase_if(block.values, [&](ValueId value) { return !live[value]; });
+            }
+        }
+};
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include "parser.hpp"
+
+using namespace std;
+
+// Keeps a source and its tree up to date across edits. An edit re-lexes and re-parses from the last top level
+// statement before the change until the token stream lines up again with a statement after it, the statements
+// outside that region keep their nodes, those after it only have their spans and lines moved. Inside the region
+// the nested scopes the edit did not touch are taken over as well, their source is skipped.
+// Replaced nodes stay in the arrays, unreachable from the root, until they outnumber the live ones and a full
+// parse compacts the program.
+class IncrementalParser {
+    public:
+        // Throws CompileError if `source` does not parse.
+        inline explicit IncrementalParser(string source): _source(move(source)) {
+            _damage = {.begin = 0, .oldEnd = 0, .newEnd = static_cast<uint32_t>(_source.size())};
+            reparse();
+        }
+
+        // Replaces the bytes [begin, end) of the source with `text` and updates the tree. On a CompileError the
+        // source keeps the edit and the tree stays at the last source that parsed, the next edit repairs both.
+        void edit(size_t begin, size_t end, string_view text) {
+            if(begin > end || end > _source.size()) throw CompileError(0, "Internal Error: Edit outside of the source.");
+            _source.replace(begin, end - begin, text);
+            // the damage is kept as the range of the last parsed source and what it became, edits that failed
+            // to parse widen it until one succeeds
+            uint32_t newEnd = static_cast<uint32_t>(begin + text.size());
+            if(!_damaged) {
+                _damage = {.begin = static_cast<uint32_t>(begin), .oldEnd = static_cast<uint32_t>(end), .newEnd = newEnd};
+            } else {
+                if(end > _damage.newEnd) _damage.oldEnd += static_cast<uint32_t>(end) - _damage.newEnd;
+                _damage.newEnd = max(_damage.newEnd, static_cast<uint32_t>(end)) - static_cast<uint32_t>(end) + newEnd;
+                _damage.begin = min(_damage.begin, static_cast<uint32_t>(begin));
+            }
+            _damaged = true;
+            reparse();
+        }
+
+        [[nodiscard]] inline const NodeProgram& program() const { return _program; }
+        [[nodiscard]] inline string_view source() const { return _source; }
+        // Top level statements the last edit kept, and those it parsed again.
+        [[nodiscard]] inline size_t reused() const { return _reused; }
+        [[nodiscard]] inline size_t reparsed() const { return _reparsed; }
+        // Nested scopes of the statements parsed again that the last edit kept.
+        [[nodiscard]] inline size_t reusedScopes() const { return _reusedScopes; }
+
+    private:
+        struct TopLevel {
+            NodeIndex statement = 0;
+            SourceSpan span {}; // a copy of the statement's, the program is with the parser while it is needed
+            uint32_t lookahead = 0; // end of the token after the statement, which decided where the statement ends
+            int firstLine = 0, lastLine = 0;
+            uint32_t statements = 0; // in its tree, for deciding when to compact
+        };
+
+        // A nested scope kept by the running parse, moved by `delta` bytes and `lineDelta` lines once it succeeds.
+        struct KeptScope {
+            NodeIndex scope;
+            int64_t delta;
+            int lineDelta;
+            uint32_t statements;
+        };
+
+        // [begin, oldEnd) of the last parsed source is now [begin, newEnd).
+        struct Damage {
+            uint32_t begin, oldEnd, newEnd;
+        };
+
+        string _source;
+        SymbolTable _symbols { true }; // the names outlive every version of the source
+        NodeProgram _program {};
+        vector<TopLevel> _topLevel {};
+        vector<NodeIndex> _roots {}; // the root scope's body being assembled
+        Damage _damage {};
+        bool _damaged = false;
+        size_t _reused = 0, _reparsed = 0, _reusedScopes = 0;
+
+        void reparse() {
+            // keep everything up to the last statement whose parse did not look into the damage
+            size_t first = partition_point(_topLevel.begin(), _topLevel.end(), [&](const TopLevel& topLevel) { return topLevel.lookahead < _damage.begin; }) - _topLevel.begin();
+            size_t offset = first > 0 ? _topLevel[first - 1].span.end : 0;
+            int line = first > 0 ? _topLevel[first - 1].lastLine : 0;
+            // statements starting behind the damage can be spliced back once the new tokens reach one of them
+            size_t next = partition_point(_topLevel.begin() + first, _topLevel.end(), [&](const TopLevel& topLevel) { return topLevel.span.begin < _damage.oldEnd; }) - _topLevel.begin();
+            int64_t delta = static_cast<int64_t>(_damage.newEnd) - _damage.oldEnd;
+
+            // the root scope was added last, its children are reclaimed before the new ones are appended
+            if(!_program.scopes.empty()) {
+                _program.children.resize(_program.scopes[_program.root].first);
+                _program.scopes.pop_back();
+            }
+            NodeProgram::Sizes before = _program.sizes();
+            Tokenizer tokenizer(_source, _symbols, offset, line);
+            Parser parser(tokenizer, move(_program));
+            vector<KeptScope> kept;
+            parser.reuseScopes([&](const Token& open, bool inFunction) { return reuseScope(parser.program(), open, inFunction, first, delta, kept); });
+            vector<TopLevel> parsed;
+            int lineDelta = 0;
+            try {
+                while(optional<Token> upcoming = parser.upcoming()) {
+                    while(next < _topLevel.size() && _topLevel[next].span.begin + delta < upcoming->offset) next++;
+                    if(next < _topLevel.size() && _topLevel[next].span.begin + delta == upcoming->offset) {
+                        lineDelta = upcoming->line - _topLevel[next].firstLine; // in step with the old tokens again
+                        break;
+                    }
+                    TopLevel topLevel {.firstLine = upcoming->line};
+                    uint32_t start = parser.program().sizes().statements;
+                    size_t keptBefore = kept.size();
+                    topLevel.statement = parser.parseNext().value();
+                    topLevel.span = parser.program().statement(topLevel.statement).span;
+                    topLevel.statements = parser.program().sizes().statements - start;
+                    for(size_t i = keptBefore; i < kept.size(); i++) topLevel.statements += kept[i].statements;
+                    optional<Token> after = parser.upcoming();
+                    topLevel.lookahead = after.has_value() ? after->end() : static_cast<uint32_t>(_source.size());
+                    topLevel.lastLine = parser.lastLine();
+                    parsed.push_back(topLevel);
+                }
+                if(!parser.upcoming().has_value()) next = _topLevel.size();
+            } catch(const CompileError&) {
+                _program = parser.release();
+                _program.truncate(before);
+                addRoot();
+                throw;
+            }
+            _program = parser.release();
+
+            for(const KeptScope& scope : kept) shiftScope(scope.scope, scope.delta, scope.lineDelta);
+            for(size_t i = next; i < _topLevel.size(); i++) shift(_topLevel[i], delta, lineDelta);
+            _reused = first + (_topLevel.size() - next);
+            _reparsed = parsed.size();
+            _reusedScopes = kept.size();
+            _topLevel.erase(_topLevel.begin() + first, _topLevel.begin() + next);
+            _topLevel.insert(_topLevel.begin() + first, parsed.begin(), parsed.end());
+            _damaged = false;
+            addRoot();
+
+            size_t live = 0;
+            for(const TopLevel& topLevel : _topLevel) live += topLevel.statements;
+            if(_program.statements.size() > 2 * live + 1024) compact();
+        }
+
+        void addRoot() {
+            _roots.clear();
+            for(const TopLevel& topLevel : _topLevel) _roots.push_back(topLevel.statement);
+            _program.root = _program.addScope(_roots, {.begin = 0, .end = _topLevel.empty() ? 0 : _topLevel.back().span.end});
+            for(uint32_t symbol = 0; symbol < _symbols.size(); symbol++) _program.addName(symbol, _symbols.name(symbol)); // the parser's views die with this version of the source
+        }
+
+        // Parses the whole source into a fresh program, dropping the nodes no statement uses anymore.
+        void compact() {
+            _program.clear();
+            _topLevel.clear();
+            _damage = {.begin = 0, .oldEnd = 0, .newEnd = static_cast<uint32_t>(_source.size())};
+            reparse();
+        }
+
+        // Takes over the scope of the last parsed tree whose `{` is now where `open` is, unless the edit touched it or
+        // it moves into or out of a function, which changes whether it may `return`.
+        optional<Parser::ReusedScope> reuseScope(const NodeProgram& program, const Token& open, bool inFunction, size_t first, int64_t delta, vector<KeptScope>& kept) const {
+            uint32_t offset; // of the `{` in the last parsed source
+            if(open.offset < _damage.begin) offset = open.offset;
+            else if(open.offset >= _damage.newEnd) offset = static_cast<uint32_t>(open.offset - delta);
+            else return {};
+            optional<pair<NodeIndex, bool>> found = findScope(program, offset, first);
+            if(!found.has_value() || found->second != inFunction) return {};
+            const NodeScope& scope = program.scopes[found->first];
+            if(scope.span.end > _damage.begin && scope.span.begin < _damage.oldEnd) return {};
+
+            int lineDelta = open.line - scope.line;
+            kept.push_back({.scope = found->first, .delta = static_cast<int64_t>(open.offset) - offset, .lineDelta = lineDelta, .statements = countStatements(program, found->first)});
+            return Parser::ReusedScope{.scope = found->first, .end = open.offset + (scope.span.end - scope.span.begin), .lastLine = scope.lastLine + lineDelta};
+        }
+
+        // The scope whose `{` is at `offset` of the last parsed source, in the top level statements from `first` on,
+        // and whether it is inside a function. Descends through the statements containing the offset.
+        optional<pair<NodeIndex, bool>> findScope(const NodeProgram& program, uint32_t offset, size_t first) const {
+            auto after = partition_point(_topLevel.begin() + first, _topLevel.end(), [&](const TopLevel& topLevel) { return topLevel.span.begin <= offset; });
+            if(after == _topLevel.begin() + first) return {};
+            NodeIndex index = prev(after)->statement;
+            bool inFunction = false;
+            while(true) {
+                const NodeStatement& statement = program.statement(index);
+                if(statement.kind < StatementKind::SCOPE) return {};
+                inFunction = inFunction || statement.kind == StatementKind::FUNCTION;
+                const NodeScope& scope = program.scopes[statement.scope];
+                if(scope.span.begin == offset) return pair(statement.scope, inFunction);
+                if(offset < scope.span.begin || offset >= scope.span.end) return {};
+                span<const NodeIndex> body = program.body(statement.scope);
+                auto child = partition_point(body.begin(), body.end(), [&](NodeIndex child) { return program.statement(child).span.begin <= offset; });
+                if(child == body.begin()) return {};
+                index = *prev(child);
+            }
+        }
+
+        static uint32_t countStatements(const NodeProgram& program, NodeIndex scope) {
+            uint32_t count = 0;
+            for(NodeIndex index : program.body(scope)) {
+                const NodeStatement& statement = program.statement(index);
+                count += 1 + (statement.kind >= StatementKind::SCOPE ? countStatements(program, statement.scope) : 0);
+            }
+            return count;
+        }
+
+        // Moves the nodes of a statement behind the edit to where its text is now.
+        void shift(TopLevel& topLevel, int64_t delta, int lineDelta) {
+            if(delta == 0 && lineDelta == 0) return;
+            shiftStatement(topLevel.statement, delta, lineDelta);
+            relocate(topLevel.span, delta);
+            topLevel.lookahead = static_cast<uint32_t>(topLevel.lookahead + delta);
+            topLevel.firstLine += lineDelta;
+            topLevel.lastLine += lineDelta;
+        }
+
+        void shiftStatement(NodeIndex index, int64_t delta, int lineDelta) {
+            NodeStatement& statement = _program.statements[index];
+            relocate(statement.span, delta);
+            statement.line += lineDelta;
+            bool hasExpression = statement.kind <= StatementKind::RETURN || statement.kind == StatementKind::IF || statement.kind == StatementKind::WHILE;
+            if(hasExpression && lineDelta != 0) shiftExpression(statement.expression, lineDelta);
+            if(statement.kind >= StatementKind::SCOPE) shiftScope(statement.scope, delta, lineDelta);
+        }
+
+        void shiftScope(NodeIndex index, int64_t delta, int lineDelta) {
+            if(delta == 0 && lineDelta == 0) return;
+            NodeScope& scope = _program.scopes[index];
+            relocate(scope.span, delta);
+            scope.line += lineDelta;
+            scope.lastLine += lineDelta;
+            for(NodeIndex statement : _program.body(index)) shiftStatement(statement, delta, lineDelta);
+        }
+
+        void shiftExpression(NodeIndex index, int lineDelta) {
+            NodeExpression& expression = _program.expressions[index];
+            expression.line += lineDelta;
+            if(expression.isBinary()) {
+                shiftExpression(expression.left(), lineDelta);
+                shiftExpression(expression.right(), lineDelta);
+            } else if(expression.kind == ExpressionKind::CALL) {
+                for(NodeIndex argument : _program.argumentsOf(expression)) shiftExpression(argument, lineDelta);
+            }
+        }
+
+        static void relocate(SourceSpan& span, int64_t delta) {
+            span.begin = static_cast<uint32_t>(span.begin + delta);
+            span.end = static_cast<uint32_t>(span.end + delta);
+        }
+};
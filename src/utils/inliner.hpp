@@ -0,0 +1,190 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include <algorithm>
+#include "ast.hpp"
+
+using namespace std;
+
+// Replaces calls of small functions by what they return. A function qualifies when its body is `let`s of pure
+// values followed by one `return`, reading nothing but its parameters and those lets: the call then becomes the
+// returned expression with every name replaced by a copy of what it stands for. The arguments have to be pure,
+// so that evaluating them once per use, or not at all, cannot be observed.
+// Whether a call is worth it is decided by size: the substituted expression may be larger than the call and its
+// arguments by a fixed budget, the body of a larger function is shared by all its callers instead.
+class Inliner {
+    public:
+        inline explicit Inliner(NodeProgram& program): _program(program) { }
+
+        // Returns the number of calls replaced.
+        size_t run() {
+            for(NodeIndex index : _program.body(_program.root)) {
+                const NodeStatement& statement = _program.statement(index);
+                if(statement.kind == StatementKind::FUNCTION) _functions.try_emplace(statement.symbol, index); // the generator reports redefinitions
+            }
+            if(_functions.empty()) return 0;
+            inlineScope(_program.root);
+            return _inlined;
+        }
+
+    private:
+        // Expression nodes a call costs on top of its arguments: moving them, saving registers, the call and return.
+        static constexpr size_t callCost = 8;
+        // Nodes an inlined call may add over the call it replaces.
+        static constexpr size_t growth = 8;
+        // Inlined bodies are searched for further calls to inline this deep.
+        static constexpr size_t maxDepth = 4;
+
+        // A function that can be inlined: its lets and the expression it returns.
+        struct Inlinable {
+            vector<pair<uint32_t, NodeIndex>> lets {};
+            NodeIndex result = 0;
+        };
+
+        NodeProgram& _program;
+        unordered_map<uint32_t, NodeIndex> _functions {}; // the FUNCTION statement by name
+        unordered_map<uint32_t, optional<Inlinable>> _inlinable {}; // by name, filled as functions are called
+        vector<uint32_t> _inlining {}; // the functions whose body is being inlined, innermost last
+        size_t _inlined = 0;
+
+        void inlineScope(NodeIndex scope) {
+            for(NodeIndex index : _program.body(scope)) {
+                NodeStatement statement = _program.statement(index); // a copy, inlining appends to the node arrays
+                if(statement.kind <= StatementKind::RETURN || statement.kind == StatementKind::IF || statement.kind == StatementKind::WHILE) inlineExpression(statement.expression);
+                if(statement.kind == StatementKind::FUNCTION) _inlining.push_back(statement.symbol); // never into itself
+                if(statement.kind >= StatementKind::SCOPE) inlineScope(statement.scope);
+                if(statement.kind == StatementKind::FUNCTION) _inlining.pop_back();
+            }
+        }
+
+        // Arguments first, a call whose arguments were inlined into pure expressions can be inlined itself.
+        void inlineExpression(NodeIndex index) {
+            NodeExpression expression = _program.expression(index);
+            if(expression.isBinary()) {
+                inlineExpression(expression.left());
+                inlineExpression(expression.right());
+            } else if(expression.kind == ExpressionKind::CALL) {
+                vector<NodeIndex> arguments(_program.argumentsOf(expression).begin(), _program.argumentsOf(expression).end());
+                for(NodeIndex argument : arguments) inlineExpression(argument);
+                inlineCall(index);
+            }
+        }
+
+        void inlineCall(NodeIndex index) {
+            NodeExpression call = _program.expression(index);
+            uint32_t callee = _program.callee(call);
+            if(_inlining.size() >= maxDepth || ranges::find(_inlining, callee) != _inlining.end()) return;
+            const Inlinable* inlinable = find(callee);
+            if(inlinable == nullptr) return;
+            span<const uint32_t> parameters = _program.parametersOf(_program.statement(_functions.at(callee)));
+            vector<NodeIndex> arguments(_program.argumentsOf(call).begin(), _program.argumentsOf(call).end());
+            if(arguments.size() != parameters.size()) return; // left for the generator to report
+            if(!ranges::all_of(arguments, [&](NodeIndex argument) { return isPure(_program, argument); })) return;
+
+            // the cost model, in expression nodes
+            unordered_map<uint32_t, size_t> sizes;
+            size_t callSize = callCost;
+            for(size_t i = 0; i < arguments.size(); i++) {
+                sizes[parameters[i]] = size(arguments[i], {});
+                callSize += sizes[parameters[i]];
+            }
+            for(auto [symbol, value] : inlinable->lets) sizes[symbol] = size(value, sizes);
+            if(size(inlinable->result, sizes) > callSize + growth) return;
+
+            unordered_map<uint32_t, NodeIndex> bindings;
+            for(size_t i = 0; i < arguments.size(); i++) bindings[parameters[i]] = arguments[i];
+            for(auto [symbol, value] : inlinable->lets) bindings[symbol] = copy(value, bindings, call.line);
+            NodeIndex result = copy(inlinable->result, bindings, call.line);
+            _program.expressions[index] = _program.expressions[result];
+            _program.expressions[index].line = call.line;
+            _inlined++;
+
+            _inlining.push_back(callee);
+            inlineExpression(index); // the body may call further functions
+            _inlining.pop_back();
+        }
+
+        // The inlinable form of the function, null if it has none.
+        const Inlinable* find(uint32_t symbol) {
+            auto function = _functions.find(symbol);
+            if(function == _functions.end()) return nullptr;
+            auto [it, inserted] = _inlinable.try_emplace(symbol);
+            if(inserted) it->second = analyze(_program.statement(function->second));
+            return it->second.has_value() ? &it->second.value() : nullptr;
+        }
+
+        optional<Inlinable> analyze(const NodeStatement& function) {
+            vector<uint32_t> bound(_program.parametersOf(function).begin(), _program.parametersOf(function).end());
+            for(size_t i = 0; i < bound.size(); i++) {
+                if(ranges::find(bound.begin(), bound.begin() + i, bound[i]) != bound.begin() + i) return {}; // a repeated parameter is an error
+            }
+            Inlinable inlinable;
+            span<const NodeIndex> body = _program.body(function.scope);
+            for(size_t i = 0; i < body.size(); i++) {
+                const NodeStatement& statement = _program.statement(body[i]);
+                if(statement.kind == StatementKind::RETURN && i + 1 == body.size() && reads(statement.expression, bound)) {
+                    inlinable.result = statement.expression;
+                    return inlinable;
+                }
+                if(statement.kind != StatementKind::LET || !isPure(_program, statement.expression) || !reads(statement.expression, bound)) return {};
+                if(ranges::find(bound, statement.symbol) != bound.end()) return {};
+                inlinable.lets.emplace_back(statement.symbol, statement.expression);
+                bound.push_back(statement.symbol);
+            }
+            return {};
+        }
+
+        // Whether the expression only reads the given names.
+        bool reads(NodeIndex index, const vector<uint32_t>& bound) const {
+            const NodeExpression& expression = _program.expression(index);
+            if(expression.kind == ExpressionKind::IDENTIFIER) return ranges::find(bound, expression.symbol) != bound.end();
+            if(expression.isBinary()) return reads(expression.left(), bound) && reads(expression.right(), bound);
+            if(expression.kind == ExpressionKind::CALL) {
+                return ranges::all_of(_program.argumentsOf(expression), [&](NodeIndex argument) { return reads(argument, bound); });
+            }
+            return true;
+        }
+
+        // Nodes of the expression once the names in `sizes` are replaced by expressions of that size.
+        size_t size(NodeIndex index, const unordered_map<uint32_t, size_t>& sizes) const {
+            const NodeExpression& expression = _program.expression(index);
+            if(expression.kind == ExpressionKind::IDENTIFIER) {
+                auto it = sizes.find(expression.symbol);
+                return it != sizes.end() ? it->second : 1;
+            }
+            if(expression.isBinary()) return 1 + size(expression.left(), sizes) + size(expression.right(), sizes);
+            if(expression.kind == ExpressionKind::CALL) {
+                size_t total = callCost;
+                for(NodeIndex argument : _program.argumentsOf(expression)) total += size(argument, sizes);
+                return total;
+            }
+            return 1;
+        }
+
+        // Appends a copy of the expression with the bound names replaced by copies of their expressions. Every use
+        // gets its own nodes, the passes after this one rewrite nodes in place.
+        NodeIndex copy(NodeIndex index, const unordered_map<uint32_t, NodeIndex>& bindings, int line) {
+            NodeExpression expression = _program.expression(index);
+            if(expression.kind == ExpressionKind::IDENTIFIER) {
+                auto it = bindings.find(expression.symbol);
+                if(it != bindings.end()) return copy(it->second, {}, line);
+            } else if(expression.isBinary()) {
+                NodeIndex left = copy(expression.left(), bindings, line);
+                NodeIndex right = copy(expression.right(), bindings, line);
+                NodeIndex result = _program.addBinary(expression.kind, left, right);
+                _program.expressions[result].line = line;
+                return result;
+            } else if(expression.kind == ExpressionKind::CALL) {
+                vector<NodeIndex> arguments;
+                for(size_t i = 0; i < _program.calls[expression.call].count; i++) {
+                    arguments.push_back(copy(_program.arguments[_program.calls[expression.call].first + i], bindings, line));
+                }
+                return _program.addCall(_program.callee(expression), arguments, line);
+            }
+            expression.line = line;
+            _program.expressions.push_back(expression);
+            return static_cast<NodeIndex>(_program.expressions.size() - 1);
+        }
+};
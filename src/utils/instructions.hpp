@@ -0,0 +1,84 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <variant>
+#include <optional>
+
+using namespace std;
+
+// Registers are listed in their x86-64 encoding order.
+enum class Register {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+enum class Opcode {
+    LABEL, MOV, PUSH, POP, ADD, SUB, IMUL, DIV, XOR, CMP, JE, JMP, SYSCALL, RET, SHL, SHR, LEA, MUL, JNE, CALL
+};
+
+struct Immediate { uint64_t value; bool operator==(const Immediate&) const = default; };
+// QWORD [base + index * scale + offset], the index is only used by lea
+struct Memory {
+    Register base;
+    int32_t offset;
+    optional<Register> index {};
+    uint8_t scale = 1;
+    bool operator==(const Memory&) const = default;
+};
+struct Label { string name; bool operator==(const Label&) const = default; };
+using Operand = variant<Register, Immediate, Memory, Label>;
+
+struct Instruction {
+    Opcode opcode;
+    vector<Operand> operands {};
+};
+
+inline const char* registerName(Register reg) {
+    static const char* names[] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+    };
+    return names[static_cast<int>(reg)];
+}
+
+inline const char* opcodeName(Opcode opcode) {
+    static const char* names[] = {
+        "", "mov", "push", "pop", "add", "sub", "imul", "div", "xor", "cmp", "je", "jmp", "syscall", "ret", "shl", "shr", "lea", "mul", "jne", "call"
+    };
+    return names[static_cast<int>(opcode)];
+}
+
+inline ostream& operator<<(ostream& out, const Operand& operand) {
+    struct OperandVisitor {
+        ostream& out;
+        void operator()(Register reg) const { out << registerName(reg); }
+        void operator()(const Immediate& immediate) const { out << immediate.value; }
+        void operator()(const Memory& memory) const {
+            out << "QWORD [" << registerName(memory.base);
+            if(memory.index.has_value()) out << " + " << registerName(*memory.index) << "*" << static_cast<int>(memory.scale);
+            out << " + " << memory.offset << "]";
+        }
+        void operator()(const Label& label) const { out << label.name; }
+    };
+    visit(OperandVisitor{.out = out}, operand);
+    return out;
+}
+
+// Prints the instructions as NASM assembly.
+inline void writeAssembly(ostream& out, const vector<Instruction>& instructions) {
+    out << "global _start\n";
+    bool first = true;
+    for(const Instruction& instruction : instructions) {
+        if(instruction.opcode == Opcode::LABEL) {
+            if(!first) out << "\n";
+            out << get<Label>(instruction.operands.at(0)).name << ":\n";
+        } else {
+            out << "    " << opcodeName(instruction.opcode);
+            for(size_t i = 0; i < instruction.operands.size(); i++) out << (i == 0 ? " " : ", ") << instruction.operands[i];
+            out << "\n";
+        }
+        first = false;
+    }
+}
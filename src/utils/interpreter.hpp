@@ -0,0 +1,102 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include "bytecode.hpp"
+
+using namespace std;
+
+// Direct threaded interpreter: every instruction is translated to the address of its handler once,
+// and each handler jumps straight to the next one through a computed goto.
+class Interpreter {
+    public:
+        inline explicit Interpreter(const BytecodeProgram& program): _program(program) { }
+
+        // Runs the program and returns the value it passed to `exit`.
+        uint64_t run() {
+            static void* const handlers[] = {
+                &&op_loadk, &&op_move, &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_jumpz, &&op_jumpnz, &&op_jump, &&op_exit,
+                &&op_call, &&op_return
+            };
+
+            struct Threaded { void* handler; uint32_t a; uint32_t b; uint32_t c; };
+            vector<Threaded> code;
+            code.reserve(_program.code.size());
+            for(const BytecodeInstruction& instruction : _program.code) {
+                code.push_back({.handler = handlers[static_cast<int>(instruction.op)], .a = instruction.a, .b = instruction.b, .c = instruction.c});
+            }
+            vector<uint64_t> registers(_program.registerCount, 0);
+            uint64_t* r = registers.data();
+            struct Frame { const Threaded* ip; size_t base; };
+            vector<Frame> frames; // of the callers, the registers of a frame start at `base`
+            const uint64_t* constants = _program.constants.data();
+            const Threaded* base = code.data();
+            const Threaded* ip = base;
+
+            #define DISPATCH() goto *ip->handler
+            DISPATCH();
+
+            op_loadk:
+                r[ip->a] = constants[ip->b];
+                ip++;
+                DISPATCH();
+            op_move:
+                r[ip->a] = r[ip->b];
+                ip++;
+                DISPATCH();
+            op_add:
+                r[ip->a] = r[ip->b] + r[ip->c];
+                ip++;
+                DISPATCH();
+            op_sub:
+                r[ip->a] = r[ip->b] - r[ip->c];
+                ip++;
+                DISPATCH();
+            op_mul:
+                r[ip->a] = r[ip->b] * r[ip->c];
+                ip++;
+                DISPATCH();
+            op_div:
+                if(r[ip->c] == 0) {
+                    cerr << "Runtime Error: Division by zero." << endl;
+                    exit(EXIT_FAILURE);
+                }
+                r[ip->a] = r[ip->b] / r[ip->c];
+                ip++;
+                DISPATCH();
+            op_jumpz:
+                ip = r[ip->a] == 0 ? base + ip->b : ip + 1;
+                DISPATCH();
+            op_jumpnz:
+                ip = r[ip->a] != 0 ? base + ip->b : ip + 1;
+                DISPATCH();
+            op_jump:
+                ip = base + ip->a;
+                DISPATCH();
+            op_exit:
+                return r[ip->a];
+            op_call: {
+                const BytecodeFunction& function = _program.functions[ip->b];
+                size_t frame = static_cast<size_t>(r - registers.data());
+                size_t callee = frame + ip->a;
+                if(callee + function.registerCount > registers.size()) {
+                    registers.resize(max(callee + function.registerCount, registers.size() * 2));
+                }
+                frames.push_back({.ip = ip + 1, .base = frame});
+                r = registers.data() + callee;
+                ip = base + function.entry;
+                DISPATCH();
+            }
+            op_return: {
+                r[0] = r[ip->a]; // the caller's register that held the first argument
+                r = registers.data() + frames.back().base;
+                ip = frames.back().ip;
+                frames.pop_back();
+                DISPATCH();
+            }
+            #undef DISPATCH
+        }
+
+    private:
+        const BytecodeProgram& _program;
+};
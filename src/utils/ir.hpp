@@ -0,0 +1,411 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include "ast.hpp"
+#include "symbols.hpp"
+#include "diagnostics.hpp"
+
+using namespace std;
+
+// An SSA intermediate representation: every value is defined once, by a constant, an arithmetic operation or a phi
+// at the start of a block, and blocks end in a single terminator. Values and blocks are indices into flat arrays.
+using ValueId = uint32_t;
+using BlockId = uint32_t;
+
+enum class IrOp : uint8_t { CONST, ADD, SUB, MUL, DIV, PHI };
+
+struct IrValue {
+    IrOp op;
+    BlockId block;
+    uint64_t constant = 0; // CONST
+    ValueId operands[2] = {}; // ADD, SUB, MUL and DIV, left and right
+    vector<ValueId> inputs {}; // PHI, one per predecessor of the block, in the same order
+};
+
+enum class IrTerminatorKind : uint8_t { NONE, JUMP, BRANCH, EXIT };
+
+// A BRANCH goes to targets[0] when its value is not zero and to targets[1] otherwise, a JUMP always to targets[0].
+struct IrTerminator {
+    IrTerminatorKind kind = IrTerminatorKind::NONE;
+    ValueId value = 0; // BRANCH and EXIT
+    BlockId targets[2] = {};
+};
+
+struct IrBlock {
+    vector<ValueId> phis {};
+    vector<ValueId> values {}; // everything but the phis, in execution order
+    vector<BlockId> predecessors {};
+    IrTerminator terminator {};
+    bool removed = false;
+
+    [[nodiscard]] inline size_t successorCount() const {
+        return terminator.kind == IrTerminatorKind::BRANCH ? 2 : terminator.kind == IrTerminatorKind::JUMP ? 1 : 0;
+    }
+};
+
+struct IrFunction {
+    vector<IrValue> values {};
+    vector<IrBlock> blocks {};
+    vector<BlockId> layout {}; // the order blocks are emitted in, block 0 is the entry and comes first
+    vector<ValueId> forward {}; // a replaced value points at its replacement, every other value at itself
+    unordered_map<uint64_t, ValueId> constants {}; // constants are defined once, in the entry block
+
+    BlockId addBlock() {
+        blocks.emplace_back();
+        return static_cast<BlockId>(blocks.size() - 1);
+    }
+
+    ValueId addValue(IrValue value, bool phi = false) {
+        BlockId block = value.block;
+        values.push_back(move(value));
+        ValueId id = static_cast<ValueId>(values.size() - 1);
+        forward.push_back(id);
+        (phi ? blocks[block].phis : blocks[block].values).push_back(id);
+        return id;
+    }
+
+    ValueId constant(uint64_t value) {
+        auto [it, inserted] = constants.try_emplace(value, static_cast<ValueId>(values.size()));
+        if(inserted) addValue({.op = IrOp::CONST, .block = 0, .constant = value});
+        return it->second;
+    }
+
+    // Follows replacements to the value that stands for `value` now, compressing the path on the way.
+    ValueId resolve(ValueId value) {
+        ValueId root = value;
+        while(forward[root] != root) root = forward[root];
+        while(forward[value] != root) value = exchange(forward[value], root);
+        return root;
+    }
+
+    void replace(ValueId value, ValueId replacement) { forward[value] = resolve(replacement); }
+
+    [[nodiscard]] inline bool isConstant(ValueId value) const { return values[value].op == IrOp::CONST; }
+
+    // Division traps unless the divisor is a constant other than zero.
+    [[nodiscard]] bool isTrapping(ValueId value) {
+        if(values[value].op != IrOp::DIV) return false;
+        ValueId divisor = resolve(values[value].operands[1]);
+        return !isConstant(divisor) || values[divisor].constant == 0;
+    }
+
+    void addEdge(BlockId from, BlockId to) { blocks[to].predecessors.push_back(from); }
+
+    void removeEdge(BlockId from, BlockId to) {
+        IrBlock& block = blocks[to];
+        for(size_t i = 0; i < block.predecessors.size(); i++) {
+            if(block.predecessors[i] != from) continue;
+            block.predecessors.erase(block.predecessors.begin() + i);
+            for(ValueId phi : block.phis) values[phi].inputs.erase(values[phi].inputs.begin() + i);
+            return;
+        }
+    }
+
+    // Turns a branch on a constant into a jump, returns whether it did.
+    bool foldBranch(BlockId id) {
+        IrTerminator& terminator = blocks[id].terminator;
+        if(terminator.kind != IrTerminatorKind::BRANCH || blocks[id].removed) return false;
+        ValueId condition = terminator.value = resolve(terminator.value);
+        if(!isConstant(condition)) return false;
+        bool taken = values[condition].constant != 0;
+        BlockId skipped = terminator.targets[taken ? 1 : 0];
+        terminator = {.kind = IrTerminatorKind::JUMP, .targets = { terminator.targets[taken ? 0 : 1] }};
+        removeEdge(id, skipped);
+        prune(skipped);
+        return true;
+    }
+
+    // A block left without predecessors never runs, and neither do the edges out of it.
+    void prune(BlockId id) {
+        vector<BlockId> work { id };
+        while(!work.empty()) {
+            BlockId block = work.back();
+            work.pop_back();
+            if(block == 0 || blocks[block].removed || !blocks[block].predecessors.empty()) continue;
+            blocks[block].removed = true;
+            for(size_t i = 0; i < blocks[block].successorCount(); i++) {
+                removeEdge(block, blocks[block].terminator.targets[i]);
+                work.push_back(blocks[block].terminator.targets[i]);
+            }
+        }
+    }
+
+    bool foldBranches() {
+        bool changed = false;
+        for(BlockId id : layout) changed |= foldBranch(id);
+        return changed;
+    }
+
+    // Drops the blocks the entry cannot reach, along with their edges into the blocks it can.
+    void removeUnreachable() {
+        vector<bool> reached(blocks.size(), false);
+        vector<BlockId> stack { 0 };
+        reached[0] = true;
+        while(!stack.empty()) {
+            const IrBlock& block = blocks[stack.back()];
+            stack.pop_back();
+            for(size_t i = 0; i < block.successorCount(); i++) {
+                if(!reached[block.terminator.targets[i]]) {
+                    reached[block.terminator.targets[i]] = true;
+                    stack.push_back(block.terminator.targets[i]);
+                }
+            }
+        }
+        for(BlockId id : layout) {
+            if(reached[id]) continue;
+            blocks[id].removed = true;
+            for(size_t i = 0; i < blocks[id].successorCount(); i++) {
+                if(reached[blocks[id].terminator.targets[i]]) removeEdge(id, blocks[id].terminator.targets[i]);
+            }
+        }
+        erase_if(layout, [&](BlockId id) { return !reached[id]; });
+    }
+
+    // A phi whose inputs are all the same value, or itself, is that value. Returns the replacement, or the phi.
+    ValueId trySimplifyPhi(ValueId phi) {
+        ValueId same = phi;
+        for(ValueId& input : values[phi].inputs) {
+            input = resolve(input);
+            if(input == phi || input == same) continue;
+            if(same != phi) return phi;
+            same = input;
+        }
+        if(same == phi) same = constant(0); // only read on paths that never run
+        replace(phi, same);
+        return same;
+    }
+
+    // Removes trivial phis until none are left, simplifying one can make the phis that use it trivial.
+    // Returns whether any phi was removed.
+    bool simplifyPhis() {
+        bool simplified = false, changed = true;
+        while(changed) {
+            changed = false;
+            for(BlockId id : layout) {
+                for(ValueId phi : blocks[id].phis) {
+                    if(resolve(phi) == phi && trySimplifyPhi(phi) != phi) changed = true;
+                }
+            }
+            simplified |= changed;
+        }
+        return simplified;
+    }
+
+    // Points every operand at its current value and drops the replaced values from their blocks.
+    void canonicalize() {
+        for(BlockId id : layout) {
+            IrBlock& block = blocks[id];
+            erase_if(block.phis, [&](ValueId value) { return resolve(value) != value; });
+            erase_if(block.values, [&](ValueId value) { return resolve(value) != value; });
+            for(ValueId phi : block.phis) {
+                for(ValueId& input : values[phi].inputs) input = resolve(input);
+            }
+            for(ValueId value : block.values) {
+                if(values[value].op == IrOp::CONST) continue;
+                for(ValueId& operand : values[value].operands) operand = resolve(operand);
+            }
+            if(block.terminator.kind == IrTerminatorKind::BRANCH || block.terminator.kind == IrTerminatorKind::EXIT) block.terminator.value = resolve(block.terminator.value);
+        }
+    }
+
+    void print(ostream& out) {
+        static const char* names[] = { "const", "add", "sub", "mul", "div", "phi" };
+        for(BlockId id : layout) {
+            const IrBlock& block = blocks[id];
+            out << "block_" << id << ":";
+            if(!block.predecessors.empty()) {
+                out << " ; from";
+                for(BlockId predecessor : block.predecessors) out << " block_" << predecessor;
+            }
+            out << "\n";
+            for(ValueId phi : block.phis) {
+                out << "    v" << phi << " = phi";
+                for(size_t i = 0; i < values[phi].inputs.size(); i++) out << (i == 0 ? " " : ", ") << "v" << resolve(values[phi].inputs[i]);
+                out << "\n";
+            }
+            for(ValueId value : block.values) {
+                const IrValue& definition = values[value];
+                out << "    v" << value << " = " << names[static_cast<size_t>(definition.op)];
+                if(definition.op == IrOp::CONST) out << " " << definition.constant << "\n";
+                else out << " v" << resolve(definition.operands[0]) << ", v" << resolve(definition.operands[1]) << "\n";
+            }
+            const IrTerminator& terminator = block.terminator;
+            switch(terminator.kind) {
+                case IrTerminatorKind::NONE: out << "    ; no terminator\n"; break;
+                case IrTerminatorKind::JUMP: out << "    jump block_" << terminator.targets[0] << "\n"; break;
+                case IrTerminatorKind::BRANCH: out << "    branch v" << resolve(terminator.value) << ", block_" << terminator.targets[0] << ", block_" << terminator.targets[1] << "\n"; break;
+                case IrTerminatorKind::EXIT: out << "    exit v" << resolve(terminator.value) << "\n"; break;
+            }
+        }
+    }
+};
+
+// Lowers the AST to SSA form as it walks it, with the construction of Braun et al., "Simple and Efficient
+// Construction of Static Single Assignment Form": a variable read looks up the definition in its block and
+// otherwise in the predecessors, placing phis where paths meet. Loop headers stay open for new phis until
+// the body, and so every predecessor, is known. Reports the same errors, in the same order, as the Generator.
+class IrBuilder {
+    public:
+        inline explicit IrBuilder(const NodeProgram& program): _program(program) { }
+
+        [[nodiscard]] IrFunction build() {
+            _current = addBlock(true);
+            _function.layout.push_back(_current);
+            for(NodeIndex statement : _program.body(_program.root)) buildStatement(statement);
+            terminate({.kind = IrTerminatorKind::EXIT, .value = _function.constant(0)}); // the program never runs off its end
+            return move(_function);
+        }
+
+    private:
+        const NodeProgram& _program;
+        IrFunction _function {};
+        BlockId _current = 0;
+        ScopedSymbolTable<bool> _declared {};
+        vector<unordered_map<uint32_t, ValueId>> _definitions {}; // by block, the symbols' values at its end so far
+        vector<vector<pair<uint32_t, ValueId>>> _incomplete {}; // by block, phis waiting for the block to be sealed
+        vector<bool> _sealed {}; // by block, whether all its predecessors are known
+
+        BlockId addBlock(bool sealed) {
+            BlockId block = _function.addBlock();
+            _definitions.emplace_back();
+            _incomplete.emplace_back();
+            _sealed.push_back(sealed);
+            return block;
+        }
+
+        // Places a block after the ones built so far and continues in it.
+        void enter(BlockId block) {
+            _current = block;
+            _function.layout.push_back(block);
+        }
+
+        void terminate(IrTerminator terminator) {
+            _function.blocks[_current].terminator = terminator;
+            for(size_t i = 0; i < _function.blocks[_current].successorCount(); i++) _function.addEdge(_current, terminator.targets[i]);
+        }
+
+        void write(uint32_t symbol, BlockId block, ValueId value) { _definitions[block][symbol] = value; }
+
+        ValueId read(uint32_t symbol, BlockId block) {
+            if(auto it = _definitions[block].find(symbol); it != _definitions[block].end()) return _function.resolve(it->second);
+            ValueId value;
+            const vector<BlockId>& predecessors = _function.blocks[block].predecessors;
+            if(!_sealed[block]) {
+                value = addPhi(block);
+                _incomplete[block].push_back({ symbol, value });
+            } else if(predecessors.size() == 1) {
+                value = read(symbol, predecessors.front());
+            } else if(predecessors.empty()) {
+                value = _function.constant(0); // a block nothing jumps to, it never runs
+            } else {
+                value = addPhi(block);
+                write(symbol, block, value); // breaks cycles through loops
+                value = addPhiInputs(symbol, value);
+            }
+            write(symbol, block, value);
+            return value;
+        }
+
+        ValueId addPhi(BlockId block) { return _function.addValue({.op = IrOp::PHI, .block = block}, true); }
+
+        ValueId addPhiInputs(uint32_t symbol, ValueId phi) {
+            for(BlockId predecessor : _function.blocks[_function.values[phi].block].predecessors) {
+                ValueId input = read(symbol, predecessor);
+                _function.values[phi].inputs.push_back(input);
+            }
+            return _function.trySimplifyPhi(phi);
+        }
+
+        void seal(BlockId block) {
+            for(auto [symbol, phi] : _incomplete[block]) addPhiInputs(symbol, phi);
+            _incomplete[block].clear();
+            _sealed[block] = true;
+        }
+
+        ValueId buildExpression(NodeIndex index) {
+            const NodeExpression& expression = _program.expression(index);
+            switch(expression.kind) {
+                case ExpressionKind::NUMBER:
+                    return _function.constant(expression.value);
+                case ExpressionKind::IDENTIFIER:
+                    if(_declared.find(expression.symbol) == nullptr) {
+                        throw CompileError(expression.line, "Invalid Syntax: Identifier `", _program.name(expression.symbol), "` does not exist at line ", expression.line, ".");
+                    }
+                    return read(expression.symbol, _current);
+                case ExpressionKind::CALL:
+                    throw CompileError(expression.line, "The call of `", _program.name(_program.callee(expression)), "` at line ", expression.line, " cannot be compiled with --ir, only calls the optimizer inlines can.");
+                default:
+                    break;
+            }
+            static constexpr IrOp ops[] = { IrOp::ADD, IrOp::SUB, IrOp::MUL, IrOp::DIV };
+            ValueId left = buildExpression(expression.left());
+            ValueId right = buildExpression(expression.right());
+            return _function.addValue({.op = ops[static_cast<size_t>(expression.kind) - static_cast<size_t>(ExpressionKind::ADD)], .block = _current, .operands = { left, right }});
+        }
+
+        void buildScope(NodeIndex scope) {
+            _declared.beginScope();
+            for(NodeIndex statement : _program.body(scope)) buildStatement(statement);
+            _declared.endScope();
+        }
+
+        void buildStatement(NodeIndex index) {
+            const NodeStatement& statement = _program.statement(index);
+            switch(statement.kind) {
+                case StatementKind::EXIT: {
+                    terminate({.kind = IrTerminatorKind::EXIT, .value = buildExpression(statement.expression)});
+                    enter(addBlock(true)); // whatever follows is unreachable, but still checked for errors
+                    break;
+                }
+                case StatementKind::LET: {
+                    if(_declared.find(statement.symbol) != nullptr) {
+                        throw CompileError(statement.line, "Identifier `", _program.name(statement.symbol), "` already exists at line ", statement.line, ".");
+                    }
+                    ValueId value = buildExpression(statement.expression);
+                    _declared.declare(statement.symbol, true);
+                    write(statement.symbol, _current, value);
+                    break;
+                }
+                case StatementKind::ASSIGNMENT:
+                    if(_declared.find(statement.symbol) == nullptr) {
+                        throw CompileError(statement.line, "Identifier `", _program.name(statement.symbol), "` does not exist at line ", statement.line, "!");
+                    }
+                    write(statement.symbol, _current, buildExpression(statement.expression));
+                    break;
+                case StatementKind::SCOPE:
+                case StatementKind::ELSE: // else scopes always run
+                    buildScope(statement.scope);
+                    break;
+                case StatementKind::IF: {
+                    ValueId condition = buildExpression(statement.expression);
+                    BlockId then = addBlock(true), join = addBlock(false);
+                    terminate({.kind = IrTerminatorKind::BRANCH, .value = condition, .targets = { then, join }});
+                    enter(then);
+                    buildScope(statement.scope);
+                    terminate({.kind = IrTerminatorKind::JUMP, .targets = { join }});
+                    seal(join);
+                    enter(join);
+                    break;
+                }
+                case StatementKind::WHILE: {
+                    // the condition is tested before the first iteration and again at the end of every iteration
+                    ValueId condition = buildExpression(statement.expression);
+                    BlockId body = addBlock(false), after = addBlock(false);
+                    terminate({.kind = IrTerminatorKind::BRANCH, .value = condition, .targets = { body, after }});
+                    enter(body);
+                    buildScope(statement.scope);
+                    terminate({.kind = IrTerminatorKind::BRANCH, .value = buildExpression(statement.expression), .targets = { body, after }});
+                    seal(body);
+                    seal(after);
+                    enter(after);
+                    break;
+                }
+                case StatementKind::FUNCTION: // checked by the NameResolver, and only reachable through calls, which have all been inlined
+                case StatementKind::RETURN:
+                    break;
+            }
+        }
+};
@@ -0,0 +1,367 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "ir.hpp"
+#include "generator.hpp"
+#include "arithmetic.hpp"
+
+using namespace std;
+
+// Generates code from the SSA form. Blocks are numbered in layout order and every value gets one live interval
+// from its definition to its last use, stretched over the loops it is live in. Linear scan puts the intervals in
+// the registers of the AST generator's pool, spilling the one that ends last into a stack slot for its whole life.
+// Constants are never given a location, they become immediates. Phis turn into moves on the edges into their block.
+class IrGenerator {
+    public:
+        inline IrGenerator(IrFunction& function, Target target = Target::EXECUTABLE): _function(function), _target(target) { }
+
+        [[nodiscard]] vector<Instruction> generate() {
+            number();
+            allocate();
+            emit(Opcode::LABEL, { Label{"_start"} });
+            if(_target == Target::FUNCTION) {
+                for(Register reg : calleeSaved) emit(Opcode::PUSH, { reg }); // the allocator hands these out too
+                emit(Opcode::MOV, { Register::RBP, Register::RSP }); // remember the frame to unwind on exit
+            }
+            if(_slots > 0) emit(Opcode::SUB, { Register::RSP, Immediate{_slots * 8} }); // room for the spilled values
+            for(size_t i = 0; i < _function.layout.size(); i++) {
+                BlockId id = _function.layout[i];
+                if(i > 0) emit(Opcode::LABEL, { Label{blockLabel(id)} });
+                generateBlock(id, i + 1 < _function.layout.size() ? _function.layout[i + 1] : UINT32_MAX);
+            }
+            return move(_instructions);
+        }
+
+        // Values kept in stack slots instead of registers.
+        [[nodiscard]] size_t spilled() const { return _spilled; }
+
+    private:
+        static constexpr Register calleeSaved[] = { Register::RBX, Register::RBP, Register::R12, Register::R13, Register::R14, Register::R15 };
+        static constexpr Register pool[] = {
+            Register::RBX, Register::RCX, Register::RSI, Register::RDI, Register::R8, Register::R9,
+            Register::R10, Register::R11, Register::R12, Register::R13, Register::R14, Register::R15
+        };
+
+        struct Interval { uint32_t start = 0, end = 0; };
+
+        IrFunction& _function;
+        Target _target;
+        vector<Instruction> _instructions {};
+        vector<uint32_t> _position {}; // by value, where it is defined
+        vector<uint32_t> _blockStart {}, _blockEnd {}; // by block, where its phis are defined and where its terminator is
+        vector<Interval> _intervals {}; // by value
+        vector<Operand> _locations {}; // by value, a register or a stack slot
+        size_t _slots = 0;
+        size_t _spilled = 0;
+
+        void emit(Opcode opcode, vector<Operand> operands = {}) {
+            _instructions.push_back({.opcode = opcode, .operands = move(operands)});
+        }
+
+        static string blockLabel(BlockId block) { return "block_" + to_string(block); }
+
+        [[nodiscard]] Operand location(ValueId value) const {
+            if(_function.isConstant(value)) return Immediate{_function.values[value].constant};
+            return _locations[value];
+        }
+
+        // The value as an operand of an arithmetic instruction, immediates only have 32 bits there.
+        Operand source(ValueId value, Register scratch) {
+            Operand operand = location(value);
+            if(auto immediate = get_if<Immediate>(&operand); immediate != nullptr && !fitsImm32(immediate->value)) {
+                emit(Opcode::MOV, { scratch, operand });
+                return scratch;
+            }
+            return operand;
+        }
+
+        static bool fitsImm32(uint64_t value) {
+            return static_cast<int64_t>(value) >= INT32_MIN && static_cast<int64_t>(value) <= INT32_MAX;
+        }
+
+        // Positions follow the layout: a block's phis, its values one after the other, then its terminator.
+        void number() {
+            size_t count = _function.values.size();
+            _position.assign(count, 0);
+            _intervals.assign(count, {});
+            _blockStart.assign(_function.blocks.size(), 0);
+            _blockEnd.assign(_function.blocks.size(), 0);
+            uint32_t position = 0;
+            for(BlockId id : _function.layout) {
+                const IrBlock& block = _function.blocks[id];
+                _blockStart[id] = position++;
+                for(ValueId phi : block.phis) _position[phi] = _blockStart[id];
+                for(ValueId value : block.values) _position[value] = position++;
+                _blockEnd[id] = position++;
+            }
+            for(ValueId value = 0; value < count; value++) _intervals[value] = { _position[value], _position[value] };
+
+            auto use = [&](ValueId value, uint32_t at) {
+                if(!_function.isConstant(value)) _intervals[value].end = max(_intervals[value].end, at);
+            };
+            vector<Interval> loops;
+            for(BlockId id : _function.layout) {
+                const IrBlock& block = _function.blocks[id];
+                for(size_t i = 0; i < block.phis.size(); i++) {
+                    const vector<ValueId>& inputs = _function.values[block.phis[i]].inputs;
+                    for(size_t j = 0; j < inputs.size(); j++) use(inputs[j], _blockEnd[block.predecessors[j]]); // read on the way in
+                }
+                for(ValueId value : block.values) {
+                    if(_function.isConstant(value)) continue;
+                    use(_function.values[value].operands[0], _position[value]);
+                    use(_function.values[value].operands[1], _position[value]);
+                }
+                if(block.terminator.kind == IrTerminatorKind::BRANCH || block.terminator.kind == IrTerminatorKind::EXIT) use(block.terminator.value, _blockEnd[id]);
+                for(size_t i = 0; i < block.successorCount(); i++) {
+                    BlockId target = block.terminator.targets[i];
+                    if(_blockStart[target] <= _blockStart[id]) loops.push_back({ _blockStart[target], _blockEnd[id] }); // a back edge
+                }
+            }
+
+            // A value defined before a loop and used inside it is live in the whole loop, every iteration reads it.
+            sort(loops.begin(), loops.end(), [](const Interval& a, const Interval& b) { return a.start < b.start; });
+            for(Interval& interval : _intervals) {
+                auto loop = upper_bound(loops.begin(), loops.end(), interval.start, [](uint32_t start, const Interval& l) { return start < l.start; });
+                for(; loop != loops.end() && loop->start <= interval.end; loop++) interval.end = max(interval.end, loop->end);
+            }
+        }
+
+        // Linear scan, Poletto and Sarkar, with a preference for the register of the value's first operand or
+        // phi input, so two address instructions and phi moves often need no copy.
+        void allocate() {
+            vector<ValueId> order;
+            for(BlockId id : _function.layout) {
+                for(ValueId phi : _function.blocks[id].phis) order.push_back(phi);
+                for(ValueId value : _function.blocks[id].values) {
+                    if(!_function.isConstant(value)) order.push_back(value);
+                }
+            }
+            _locations.assign(_function.values.size(), Register::RAX);
+
+            // phi inputs prefer the register of the phi they flow into when the phi comes first, as in loops
+            vector<ValueId> phiOf(_function.values.size(), UINT32_MAX);
+            for(ValueId value : order) {
+                if(_function.values[value].op != IrOp::PHI) continue;
+                for(ValueId input : _function.values[value].inputs) {
+                    if(phiOf[input] == UINT32_MAX) phiOf[input] = value;
+                }
+            }
+
+            vector<bool> allocated(_function.values.size(), false);
+            vector<optional<ValueId>> holder(size(pool)); // by pool index, the value in the register
+            vector<uint32_t> slotEnds; // by slot, where the last value in it ends
+            auto poolIndex = [](const Operand& operand) -> optional<size_t> {
+                auto reg = get_if<Register>(&operand);
+                if(reg == nullptr) return {};
+                for(size_t i = 0; i < size(pool); i++) {
+                    if(pool[i] == *reg) return i;
+                }
+                return {};
+            };
+            // a spilled value is in its slot for its whole interval, also the part before it was spilled
+            auto spill = [&](ValueId value) {
+                size_t slot = 0;
+                while(slot < slotEnds.size() && slotEnds[slot] > _intervals[value].start) slot++;
+                if(slot == slotEnds.size()) slotEnds.push_back(0);
+                slotEnds[slot] = _intervals[value].end;
+                _slots = max(_slots, slotEnds.size());
+                _locations[value] = Memory{.base = Register::RSP, .offset = static_cast<int32_t>(slot * 8)};
+                _spilled++;
+            };
+
+            for(ValueId value : order) {
+                Interval interval = _intervals[value];
+                for(optional<ValueId>& held : holder) {
+                    if(held.has_value() && _intervals[*held].end <= interval.start) held.reset();
+                }
+
+                vector<ValueId> hints;
+                const IrValue& definition = _function.values[value];
+                if(definition.op == IrOp::PHI) hints = definition.inputs;
+                else hints.push_back(definition.operands[0]);
+                if(phiOf[value] != UINT32_MAX) hints.insert(hints.begin(), phiOf[value]);
+
+                optional<size_t> chosen;
+                for(ValueId hint : hints) {
+                    if(!allocated[hint] || _function.isConstant(hint)) continue;
+                    optional<size_t> index = poolIndex(_locations[hint]);
+                    if(index.has_value() && !holder[*index].has_value()) {
+                        chosen = index;
+                        break;
+                    }
+                }
+                for(size_t i = 0; i < size(pool) && !chosen.has_value(); i++) {
+                    if(!holder[i].has_value()) chosen = i;
+                }
+                if(!chosen.has_value()) {
+                    size_t furthest = 0;
+                    for(size_t i = 1; i < size(pool); i++) {
+                        if(_intervals[*holder[i]].end > _intervals[*holder[furthest]].end) furthest = i;
+                    }
+                    if(_intervals[*holder[furthest]].end > interval.end) {
+                        spill(*holder[furthest]); // the register goes to the value needed sooner
+                        chosen = furthest;
+                    }
+                }
+                if(chosen.has_value()) {
+                    holder[*chosen] = value;
+                    _locations[value] = pool[*chosen];
+                } else {
+                    spill(value);
+                }
+                allocated[value] = true;
+            }
+        }
+
+        void generateBlock(BlockId id, BlockId next) {
+            const IrBlock& block = _function.blocks[id];
+            for(ValueId value : block.values) {
+                if(!_function.isConstant(value)) generateValue(value);
+            }
+            const IrTerminator& terminator = block.terminator;
+            switch(terminator.kind) {
+                case IrTerminatorKind::NONE:
+                    break;
+                case IrTerminatorKind::EXIT:
+                    generateExit(location(terminator.value));
+                    break;
+                case IrTerminatorKind::JUMP:
+                    generateMoves(id, terminator.targets[0]);
+                    if(terminator.targets[0] != next) emit(Opcode::JMP, { Label{blockLabel(terminator.targets[0])} });
+                    break;
+                case IrTerminatorKind::BRANCH:
+                    generateBranch(id, terminator, next);
+                    break;
+            }
+        }
+
+        void generateValue(ValueId value) {
+            const IrValue& definition = _function.values[value];
+            Operand target = location(value);
+            Operand left = location(definition.operands[0]), right = location(definition.operands[1]); // DIV
+            bool targetIsRegister = holds_alternative<Register>(target);
+            Register result = targetIsRegister ? get<Register>(target) : Register::RAX;
+
+            if(definition.op == IrOp::DIV) {
+                auto divisor = get_if<Immediate>(&right);
+                if(divisor != nullptr && divisor->value != 0) {
+                    divideByConstant(_instructions, result, left, divisor->value);
+                } else {
+                    emit(Opcode::MOV, { Register::RAX, left }); // move the dividend into rax
+                    emit(Opcode::XOR, { Register::RDX, Register::RDX }); // zero RDX for division
+                    emit(Opcode::DIV, { divisor != nullptr ? Operand(Register::RDX) : right }); // dividing by the zeroed rdx keeps the trap
+                    if(result != Register::RAX) emit(Opcode::MOV, { result, Register::RAX });
+                }
+            } else {
+                ValueId leftValue = definition.operands[0], rightValue = definition.operands[1];
+                if(definition.op != IrOp::SUB && (location(rightValue) == target || _function.isConstant(leftValue))) swap(leftValue, rightValue);
+                if(definition.op == IrOp::MUL && _function.isConstant(rightValue)) {
+                    multiplyByConstant(_instructions, result, location(leftValue), _function.values[rightValue].constant);
+                } else {
+                    static constexpr Opcode opcodes[] = { Opcode::ADD, Opcode::SUB, Opcode::IMUL };
+                    if(location(rightValue) == target && !(location(leftValue) == target)) result = Register::RAX; // sub would overwrite its right operand
+                    if(!(location(leftValue) == Operand(result))) emit(Opcode::MOV, { result, location(leftValue) });
+                    emit(opcodes[static_cast<size_t>(definition.op) - static_cast<size_t>(IrOp::ADD)], { result, source(rightValue, Register::RDX) });
+                }
+            }
+            if(!(Operand(result) == target)) emit(Opcode::MOV, { target, result });
+        }
+
+        void generateBranch(BlockId id, const IrTerminator& terminator, BlockId next) {
+            Operand condition = location(terminator.value);
+            if(holds_alternative<Memory>(condition)) {
+                emit(Opcode::MOV, { Register::RAX, condition });
+                condition = Register::RAX;
+            }
+            emit(Opcode::CMP, { condition, Immediate{0} }); // compare the condition result
+            BlockId taken = terminator.targets[0], skipped = terminator.targets[1];
+            vector<pair<Operand, Operand>> takenMoves = edgeMoves(id, taken), skippedMoves = edgeMoves(id, skipped);
+            Label takenLabel { blockLabel(taken) }, skippedLabel { blockLabel(skipped) };
+            if(takenMoves.empty() && skippedMoves.empty()) {
+                if(taken == next) {
+                    emit(Opcode::JE, { skippedLabel });
+                } else {
+                    emit(Opcode::JNE, { takenLabel });
+                    if(skipped != next) emit(Opcode::JMP, { skippedLabel });
+                }
+            } else if(skippedMoves.empty()) {
+                emit(Opcode::JE, { skippedLabel });
+                parallelMove(takenMoves);
+                if(taken != next) emit(Opcode::JMP, { takenLabel });
+            } else if(takenMoves.empty()) {
+                emit(Opcode::JNE, { takenLabel });
+                parallelMove(skippedMoves);
+                if(skipped != next) emit(Opcode::JMP, { skippedLabel });
+            } else {
+                Label edge { blockLabel(id) + "_else" }; // the moves of each edge get their own path
+                emit(Opcode::JE, { edge });
+                parallelMove(takenMoves);
+                emit(Opcode::JMP, { takenLabel });
+                emit(Opcode::LABEL, { edge });
+                parallelMove(skippedMoves);
+                if(skipped != next) emit(Opcode::JMP, { skippedLabel });
+            }
+        }
+
+        void generateMoves(BlockId from, BlockId to) { parallelMove(edgeMoves(from, to)); }
+
+        // The copies from the phi inputs of the edge into the phis, leaving out those already in place.
+        vector<pair<Operand, Operand>> edgeMoves(BlockId from, BlockId to) {
+            const IrBlock& block = _function.blocks[to];
+            size_t edge = static_cast<size_t>(find(block.predecessors.begin(), block.predecessors.end(), from) - block.predecessors.begin());
+            vector<pair<Operand, Operand>> moves;
+            for(ValueId phi : block.phis) {
+                Operand destination = location(phi), source = location(_function.values[phi].inputs[edge]);
+                if(!(destination == source)) moves.push_back({ destination, source });
+            }
+            return moves;
+        }
+
+        // Performs the copies as if all at once: a copy goes first once no other copy still reads its destination,
+        // a cycle is broken by saving one destination in rax. Memory to memory copies go through rdx.
+        void parallelMove(vector<pair<Operand, Operand>> moves) {
+            while(!moves.empty()) {
+                bool progress = false;
+                for(size_t i = 0; i < moves.size(); i++) {
+                    const Operand& destination = moves[i].first;
+                    bool read = any_of(moves.begin(), moves.end(), [&](const pair<Operand, Operand>& move) { return move.second == destination; });
+                    if(read) continue;
+                    copy(destination, moves[i].second);
+                    moves.erase(moves.begin() + i);
+                    progress = true;
+                    break;
+                }
+                if(progress) continue;
+                Operand saved = moves.front().first;
+                emit(Opcode::MOV, { Register::RAX, saved });
+                for(auto& move : moves) {
+                    if(move.second == saved) move.second = Register::RAX;
+                }
+            }
+        }
+
+        void copy(const Operand& destination, const Operand& source) {
+            auto immediate = get_if<Immediate>(&source);
+            bool direct = holds_alternative<Register>(destination) || (holds_alternative<Register>(source) || (immediate != nullptr && fitsImm32(immediate->value)));
+            if(direct) {
+                emit(Opcode::MOV, { destination, source });
+            } else {
+                emit(Opcode::MOV, { Register::RDX, source });
+                emit(Opcode::MOV, { destination, Register::RDX });
+            }
+        }
+
+        void generateExit(const Operand& value) {
+            if(_target == Target::FUNCTION) {
+                emit(Opcode::MOV, { Register::RAX, value }); // return the exit value
+                emit(Opcode::MOV, { Register::RSP, Register::RBP }); // drop the spill slots at once
+                for(size_t i = size(calleeSaved); i > 0; i--) emit(Opcode::POP, { calleeSaved[i - 1] });
+                emit(Opcode::RET);
+            } else {
+                emit(Opcode::MOV, { Register::RDI, value }); // move the exit value into rdi
+                emit(Opcode::MOV, { Register::RAX, Immediate{60} }); // syscall number for exit
+                emit(Opcode::SYSCALL); // make the syscall
+            }
+        }
+};
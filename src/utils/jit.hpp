@@ -0,0 +1,42 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <sys/mman.h>
+
+using namespace std;
+
+// Machine code copied into an executable mapping so it can be called in-process.
+// The code has to be generated for Target::FUNCTION.
+class JitFunction {
+    public:
+        inline JitFunction(const vector<uint8_t>& code, size_t entryOffset): _size(code.size()), _entryOffset(entryOffset) {
+            void* memory = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(memory == MAP_FAILED) {
+                cerr << "Failed to map memory for the compiled program." << endl;
+                exit(EXIT_FAILURE);
+            }
+            memcpy(memory, code.data(), _size);
+            if(mprotect(memory, _size, PROT_READ | PROT_EXEC) != 0) { // never writable and executable at once
+                cerr << "Failed to make the compiled program executable." << endl;
+                exit(EXIT_FAILURE);
+            }
+            _memory = memory;
+        }
+
+        inline JitFunction(const JitFunction&) = delete;
+        inline JitFunction operator=(const JitFunction&) = delete;
+        inline ~JitFunction() { munmap(_memory, _size); }
+
+        // Runs the program and returns the value it passed to `exit`.
+        inline uint64_t run() const {
+            auto entry = reinterpret_cast<uint64_t (*)()>(static_cast<char*>(_memory) + _entryOffset);
+            return entry();
+        }
+
+    private:
+        void* _memory = nullptr;
+        size_t _size;
+        size_t _entryOffset;
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include "parser.hpp"
+#include "elimination.hpp"
+#include "inliner.hpp"
+
+using namespace std;
+
+// AST level optimizations that run between parsing and code generation:
+// constant folding, propagation of constant `let` bindings, algebraic identities and constant `if` and `while` conditions,
+// inlining of small functions, followed by dead code and dead store elimination.
+class Optimizer {
+    public:
+        inline explicit Optimizer(NodeProgram program): _program(move(program)) { }
+
+        [[nodiscard]] NodeProgram optimize() {
+            optimizeStatements(_program.root);
+            _inlined = Inliner(_program).run(); // with folded bodies, so their size is what they will cost
+            if(_inlined > 0) {
+                _constants.clear();
+                optimizeStatements(_program.root); // folds the bodies into their call sites
+            }
+            _eliminated = DeadCodeEliminator(_program).run();
+            return move(_program);
+        }
+
+        // Statements removed by dead code elimination.
+        [[nodiscard]] inline size_t eliminated() const { return _eliminated; }
+        // Calls replaced by the body of their function.
+        [[nodiscard]] inline size_t inlined() const { return _inlined; }
+
+    private:
+        NodeProgram _program;
+        unordered_map<uint32_t, uint64_t> _constants {};
+        vector<vector<uint32_t>> _scopes {};
+        size_t _eliminated = 0;
+        size_t _inlined = 0;
+
+        // Returns the value of an expression that has already been folded down to a number literal.
+        optional<uint64_t> literal(NodeIndex index) const {
+            const NodeExpression& expression = _program.expression(index);
+            if(expression.kind == ExpressionKind::NUMBER) return expression.value;
+            return {};
+        }
+
+        // The node keeps its line, so errors still point at where the expression started.
+        void replaceWithNumber(NodeIndex index, uint64_t value) {
+            NodeExpression& expression = _program.expressions[index];
+            expression.kind = ExpressionKind::NUMBER;
+            expression.value = value;
+        }
+
+        void replaceWith(NodeIndex index, NodeIndex replacement) {
+            int line = _program.expressions[index].line;
+            _program.expressions[index] = _program.expressions[replacement];
+            _program.expressions[index].line = line;
+        }
+
+        void foldExpression(NodeIndex index) {
+            const NodeExpression& expression = _program.expression(index);
+            if(expression.kind == ExpressionKind::IDENTIFIER) {
+                auto it = _constants.find(expression.symbol);
+                if(it != _constants.end()) replaceWithNumber(index, it->second);
+            } else if(expression.isBinary()) {
+                foldExpression(expression.left());
+                foldExpression(expression.right());
+                simplify(index);
+            } else if(expression.kind == ExpressionKind::CALL) {
+                for(NodeIndex argument : _program.argumentsOf(expression)) foldExpression(argument);
+            }
+        }
+
+        // Folds a binary expression whose operands are already folded, or applies an identity to it.
+        void simplify(NodeIndex index) {
+            NodeExpression expression = _program.expression(index);
+            optional<uint64_t> left = literal(expression.left()), right = literal(expression.right());
+            switch(expression.kind) {
+                case ExpressionKind::ADD:
+                    if(left && right) replaceWithNumber(index, left.value() + right.value());
+                    else if(left == 0) replaceWith(index, expression.right());
+                    else if(right == 0) replaceWith(index, expression.left());
+                    break;
+                case ExpressionKind::SUBTRACT:
+                    if(left && right) replaceWithNumber(index, left.value() - right.value());
+                    else if(right == 0) replaceWith(index, expression.left());
+                    break;
+                case ExpressionKind::MULTIPLY:
+                    if(left && right) replaceWithNumber(index, left.value() * right.value());
+                    else if(left == 1) replaceWith(index, expression.right());
+                    else if(right == 1) replaceWith(index, expression.left());
+                    else if((left == 0 && isPure(_program, expression.right())) || (right == 0 && isPure(_program, expression.left()))) replaceWithNumber(index, 0);
+                    break;
+                case ExpressionKind::DIVIDE:
+                    if(right == 0) break; // keep the division so it still traps at runtime
+                    if(left && right) replaceWithNumber(index, left.value() / right.value());
+                    else if(right == 1) replaceWith(index, expression.left());
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        void setConstant(uint32_t symbol, optional<uint64_t> value) {
+            if(value.has_value()) _constants[symbol] = value.value();
+            else _constants.erase(symbol);
+        }
+
+        // Runs the scope's statements, forgetting its declarations afterwards.
+        void optimizeScope(NodeIndex scope) {
+            _scopes.emplace_back();
+            optimizeStatements(scope);
+            for(uint32_t symbol : _scopes.back()) _constants.erase(symbol);
+            _scopes.pop_back();
+        }
+
+        // Runs a scope that may or may not execute: only constants that hold on both paths survive it.
+        void optimizeConditionalScope(NodeIndex scope) {
+            unordered_map<uint32_t, uint64_t> before = _constants;
+            optimizeScope(scope);
+            for(auto it = _constants.begin(); it != _constants.end();) {
+                auto previous = before.find(it->first);
+                if(previous == before.end() || previous->second != it->second) it = _constants.erase(it);
+                else it++;
+            }
+        }
+
+        // Dropped statements are compacted out of the scope's run of children.
+        void optimizeStatements(NodeIndex scope) {
+            NodeScope& range = _program.scopes[scope];
+            uint32_t kept = 0;
+            for(uint32_t i = 0; i < range.count; i++) {
+                NodeIndex statement = _program.children[range.first + i];
+                if(optimizeStatement(statement)) _program.children[range.first + kept++] = statement;
+            }
+            range.count = kept;
+        }
+
+        // Returns false if the statement can be dropped entirely.
+        bool optimizeStatement(NodeIndex index) {
+            NodeStatement& statement = _program.statements[index];
+            switch(statement.kind) {
+                case StatementKind::EXIT:
+                case StatementKind::RETURN:
+                    foldExpression(statement.expression);
+                    return true;
+                case StatementKind::LET:
+                    foldExpression(statement.expression);
+                    setConstant(statement.symbol, literal(statement.expression));
+                    if(!_scopes.empty()) _scopes.back().push_back(statement.symbol);
+                    return true;
+                case StatementKind::ASSIGNMENT:
+                    foldExpression(statement.expression);
+                    setConstant(statement.symbol, literal(statement.expression));
+                    return true;
+                case StatementKind::SCOPE:
+                    optimizeScope(statement.scope);
+                    return true;
+                case StatementKind::IF: {
+                    foldExpression(statement.expression);
+                    optional<uint64_t> condition = literal(statement.expression);
+                    if(!condition.has_value()) {
+                        optimizeConditionalScope(statement.scope);
+                        return true;
+                    }
+                    if(condition.value() == 0) return false; // the scope can never run
+                    statement.kind = StatementKind::SCOPE; // the scope always runs
+                    optimizeScope(statement.scope);
+                    return true;
+                }
+                case StatementKind::ELSE:
+                    optimizeConditionalScope(statement.scope);
+                    return true;
+                case StatementKind::WHILE: {
+                    // the condition and the body also run after iterations that may have changed what the loop assigns
+                    vector<uint32_t> assigned;
+                    collectAssignments(_program, statement.scope, assigned);
+                    for(uint32_t symbol : assigned) _constants.erase(symbol);
+                    foldExpression(statement.expression);
+                    if(literal(statement.expression) == 0) return false; // the body can never run
+                    optimizeConditionalScope(statement.scope);
+                    return true;
+                }
+                case StatementKind::FUNCTION: {
+                    // a function sees its parameters and nothing else, none of the constants around it hold inside
+                    unordered_map<uint32_t, uint64_t> constants = exchange(_constants, {});
+                    vector<vector<uint32_t>> scopes = exchange(_scopes, {});
+                    optimizeScope(statement.scope);
+                    _constants = move(constants);
+                    _scopes = move(scopes);
+                    return true;
+                }
+            }
+            return true;
+        }
+};
@@ -3,76 +3,52 @@
 #include <iostream>
 #include <vector>
 #include <optional>
-#include <variant>
-#include "allocator.hpp"
+#include <array>
+#include <functional>
+#include "ast.hpp"
 #include "tokenizer.hpp"
+#include "diagnostics.hpp"
 
 using namespace std;
 
-struct NodeExpression;
-struct NodeStatement;
-
-struct NodeTermNumber { Token number; };
-struct NodeTermIdentifier { Token identifier; };
-struct NodeTermParentheses { NodeExpression* expression; };
-struct NodeTerm { variant<NodeTermNumber*, NodeTermIdentifier*, NodeTermParentheses*> var; };
-
-struct BinaryExpressionAdd { NodeExpression* left; NodeExpression* right; };
-struct BinaryExpressionSubtract { NodeExpression* left; NodeExpression* right; };
-struct BinaryExpressionMultiply { NodeExpression* left; NodeExpression* right; };
-struct BinaryExpressionDivide { NodeExpression* left; NodeExpression* right; };
-struct BinaryExpression { variant<BinaryExpressionAdd*, BinaryExpressionSubtract*, BinaryExpressionMultiply*, BinaryExpressionDivide*> var; };
-struct NodeExpression { variant<NodeTerm*, BinaryExpression*> var; };
-
-struct NodeExit { NodeExpression* exp; };
-struct NodeLet { Token identifier; NodeExpression* value; };
-struct NodeAssignment { Token identifier; NodeExpression* value; };
-struct NodeScope { vector<NodeStatement*> statements; };
-struct NodeIf { NodeExpression* condition; NodeScope* scope; };
-struct NodeElse { NodeScope* scope; };
-struct NodeStatement { variant<NodeExit*, NodeLet*, NodeScope*, NodeIf*, NodeElse*, NodeAssignment*> var; };
-struct NodeProgram { vector<NodeStatement*> statements; };
-
 class Parser {
     public:
-        inline explicit Parser(const vector<Token>& tokens): _tokens(move(tokens)), _allocator(1024*1024*4) { }
+        // A scope taken over from an earlier parse, and where its source ends.
+        struct ReusedScope {
+            NodeIndex scope;
+            uint32_t end; // the offset after its `}`
+            int lastLine; // the line of its `}`
+        };
+        // Offered every `{` before its scope is parsed, with whether the scope is inside a function. A scope it
+        // returns is used as it is and its source is skipped.
+        using ScopeReuse = function<optional<ReusedScope>(const Token& open, bool inFunction)>;
 
-        optional<NodeTerm*> parseTerm() {
+        // Tokens are pulled from the tokenizer as parsing goes, which has to outlive the parser.
+        // Nodes are appended to `program`, an emptied program from an earlier parse reuses its arrays.
+        inline explicit Parser(Tokenizer& tokenizer, NodeProgram program = {}): _tokenizer(tokenizer), _program(move(program)) { }
+
+        optional<NodeIndex> parseTerm() {
             if(auto number = tryConsume(TokenType::NUMBER)) {
-                auto numberTerm = _allocator.allocate<NodeTermNumber>();
-                numberTerm->number = number.value();
-                auto term = _allocator.allocate<NodeTerm>();
-                term->var = numberTerm;
-                return term;
+                return _program.addNumber(parseNumber(number->value), number->line);
             } else if(auto identifier = tryConsume(TokenType::IDENTIFIER)) {
-                auto identifierTerm = _allocator.allocate<NodeTermIdentifier>();
-                identifierTerm->identifier = identifier.value();
-                auto term = _allocator.allocate<NodeTerm>();
-                term->var = identifierTerm;
-                return term;
+                if(tryConsume(TokenType::PAR_OPEN)) return parseCall(identifier.value());
+                return _program.addIdentifier(identifier->symbol, identifier->value, identifier->line);
             } else if(auto parOpen = tryConsume(TokenType::PAR_OPEN)) {
                 auto expression = parseExp();
                 if(!expression.has_value()) {
-                    cerr << "Failed to parse expression inside parentheses at line " << parOpen->line << "." << endl;
-                    exit(EXIT_FAILURE);
+                    throw CompileError(parOpen->line, "Failed to parse expression inside parentheses at line ", parOpen->line, ".");
                 }
-                tryConsume(TokenType::PAR_CLOSE, "Invalid Syntax: Expected `)` after expression at line " + to_string(parOpen->line));
-                auto parenthesesTerm = _allocator.allocate<NodeTermParentheses>();
-                parenthesesTerm->expression = expression.value();
-                auto term = _allocator.allocate<NodeTerm>();
-                term->var = parenthesesTerm;
-                return term;
+                tryConsume(TokenType::PAR_CLOSE, parOpen->line, "Invalid Syntax: Expected `)` after expression at line " + to_string(parOpen->line));
+                return expression; // the grouping is already in the shape of the tree
             } else {
                 return {};
             }
         }
 
-        optional<NodeExpression*> parseExp(int minPrecedence = 0) {
-            optional<NodeTerm*> leftTerm = parseTerm();
+        optional<NodeIndex> parseExp(int minPrecedence = 0) {
+            optional<NodeIndex> leftTerm = parseTerm();
             if(!leftTerm.has_value()) return {};
-
-            auto leftExpression = _allocator.allocate<NodeExpression>();
-            leftExpression->var = leftTerm.value();
+            NodeIndex left = leftTerm.value();
 
             while(true) {
                 optional<Token> current = peek();
@@ -86,75 +62,93 @@ class Parser {
                 int nextPrecedence = precedence.value() + 1;
                 auto rightTerm = parseExp(nextPrecedence);
                 if(!rightTerm.has_value()) {
-                    cerr << "Failed to parse right term after operator at line " << op.line << "." << endl;
-                    exit(EXIT_FAILURE);
+                    throw CompileError(op.line, "Failed to parse right term after operator at line ", op.line, ".");
                 }
 
-                auto expression = _allocator.allocate<BinaryExpression>();
-                auto newLeftExpression = _allocator.allocate<NodeExpression>();
-                if(op.type == TokenType::PLUS) {
-                    auto addExpression = _allocator.allocate<BinaryExpressionAdd>();
-                    newLeftExpression->var = leftExpression->var;
-                    addExpression->left = newLeftExpression;
-                    addExpression->right = rightTerm.value();
-                    expression->var = addExpression;
-                } else if(op.type == TokenType::MINUS) {
-                    auto subtractExpression = _allocator.allocate<BinaryExpressionSubtract>();
-                    newLeftExpression->var = leftExpression->var;
-                    subtractExpression->left = newLeftExpression;
-                    subtractExpression->right = rightTerm.value();
-                    expression->var = subtractExpression;
-                } else if(op.type == TokenType::TIMES) {
-                    auto multiplyExpression = _allocator.allocate<BinaryExpressionMultiply>();
-                    newLeftExpression->var = leftExpression->var;
-                    multiplyExpression->left = newLeftExpression;
-                    multiplyExpression->right = rightTerm.value();
-                    expression->var = multiplyExpression;
-                } else if(op.type == TokenType::DIVIDE) {
-                    auto divideExpression = _allocator.allocate<BinaryExpressionDivide>();
-                    newLeftExpression->var = leftExpression->var;
-                    divideExpression->left = newLeftExpression;
-                    divideExpression->right = rightTerm.value();
-                    expression->var = divideExpression;
-                }
-                leftExpression->var = expression;
+                ExpressionKind kind = ExpressionKind::ADD;
+                if(op.type == TokenType::MINUS) kind = ExpressionKind::SUBTRACT;
+                else if(op.type == TokenType::TIMES) kind = ExpressionKind::MULTIPLY;
+                else if(op.type == TokenType::DIVIDE) kind = ExpressionKind::DIVIDE;
+                left = _program.addBinary(kind, left, rightTerm.value());
             }
-            return leftExpression;
+            return left;
         }
 
-        optional<NodeScope*> parseScope() {
+        optional<NodeIndex> parseScope() {
+            if(_reuse && peek().has_value() && peek().value().type == TokenType::CUR_OPEN) {
+                if(optional<ReusedScope> reused = _reuse(peek().value(), _inFunction)) {
+                    skipTo(reused->end, reused->lastLine);
+                    return reused->scope;
+                }
+            }
             auto curOpenTokenOpt = tryConsume(TokenType::CUR_OPEN);
             if(!curOpenTokenOpt.has_value()) return {};
             Token curOpenToken = curOpenTokenOpt.value();
-            NodeScope* scopeNode = _allocator.allocate<NodeScope>();
+            size_t mark = _pending.size(); // the statements of enclosing scopes stay below the mark
+            _depth++;
             while (true) {
-                if (peek().has_value() && peek().value().type == TokenType::CUR_CLOSE) break;
-                if (auto statement = parseStatement()) scopeNode->statements.push_back(statement.value());
+                if (!peek().has_value() || peek().value().type == TokenType::CUR_CLOSE) break; // a missing `}` is reported below
+                if (auto statement = parseStatement()) _pending.push_back(statement.value());
                 else break;
             }
-            tryConsume(TokenType::CUR_CLOSE, "Invalid Syntax: Expected `}` to close scope at line " + to_string(curOpenToken.line));
-            return scopeNode;
+            tryConsume(TokenType::CUR_CLOSE, curOpenToken.line, "Invalid Syntax: Expected `}` to close scope at line " + to_string(curOpenToken.line));
+            _depth--;
+            return closeScope(mark, {.begin = curOpenToken.offset, .end = _lastEnd}, curOpenToken.line, _lastLine);
+        }
+
+        optional<NodeIndex> parseStatement() {
+            uint32_t begin = peek().has_value() ? peek().value().offset : _lastEnd;
+            optional<NodeIndex> statement = parseStatementBody();
+            if(statement.has_value()) _program.statements[statement.value()].span = {.begin = begin, .end = _lastEnd};
+            return statement;
         }
 
-        optional<NodeStatement*> parseStatement() {
-            if(peek().value().type == TokenType::EXIT) {
+        optional<NodeProgram> parse() {
+            while(peek().has_value()) {
+                if(auto nodeStatement = parseStatement()) {
+                    _pending.push_back(nodeStatement.value());
+                } else {
+                    throw CompileError(_lastLine, "Failed to parse statement at line ", _lastLine, ".");
+                }
+            }
+            _program.root = closeScope(0, {.begin = 0, .end = _lastEnd});
+            return move(_program);
+        }
+
+        // For parsing one top level statement at a time: the statement, nothing at the end of the input.
+        // The caller collects the statements and adds the root scope.
+        optional<NodeIndex> parseNext() {
+            if(!peek().has_value()) return {};
+            return parseStatement();
+        }
+
+        inline void reuseScopes(ScopeReuse reuse) { _reuse = move(reuse); }
+
+        // The next token, without consuming it.
+        [[nodiscard]] inline optional<Token> upcoming() { return peek(); }
+
+        [[nodiscard]] inline const NodeProgram& program() const { return _program; }
+        [[nodiscard]] inline int lastLine() const { return _lastLine; }
+
+        // Hands the program back, also after a parse error, with the nodes added so far.
+        [[nodiscard]] inline NodeProgram release() { return move(_program); }
+
+    private:
+        optional<NodeIndex> parseStatementBody() {
+            if(peek().has_value() && peek().value().type == TokenType::EXIT) {
                 Token exitToken = consume(); // consume 'exit'
                 if(peek().has_value() && peek().value().type == TokenType::PAR_OPEN) {
-                    Token parOpenToken = consume(); // consume '('
-                    auto exitStatement = _allocator.allocate<NodeExit>();
+                    consume(); // consume '('
+                    NodeStatement exitStatement {.kind = StatementKind::EXIT, .line = exitToken.line};
                     if(auto nodeExp = parseExp()) {
-                        exitStatement->exp = nodeExp.value();
+                        exitStatement.expression = nodeExp.value();
                     } else {
-                        cerr << "Failed to parse exit expression at line " << exitToken.line << "." << endl;
-                        exit(EXIT_FAILURE);
+                        throw CompileError(exitToken.line, "Failed to parse exit expression at line ", exitToken.line, ".");
                     }
-                    tryConsume(TokenType::PAR_CLOSE, "Invalid Syntax: Expected `)` after exit expression at line " + to_string(exitToken.line));
-                    auto statementNode = _allocator.allocate<NodeStatement>();
-                    statementNode->var = exitStatement;
-                    return statementNode;
+                    tryConsume(TokenType::PAR_CLOSE, exitToken.line, "Invalid Syntax: Expected `)` after exit expression at line " + to_string(exitToken.line));
+                    return _program.addStatement(exitStatement);
                 } else {
-                    cerr << "Invalid Syntax: Expected `(` after `exit` at line " << exitToken.line << "." << endl;
-                    exit(EXIT_FAILURE);
+                    throw CompileError(exitToken.line, "Invalid Syntax: Expected `(` after `exit` at line ", exitToken.line, ".");
                 }
             } else if(peek().has_value() && peek().value().type == TokenType::LET) {
                 Token letToken = peek().value();
@@ -162,125 +156,193 @@ class Parser {
                     Token identifierToken = peek(1).value();
                     if(peek(2).has_value() && peek(2).value().type == TokenType::EQUALS) {
                         consume(); // consume 'let'
-                        auto letNode = _allocator.allocate<NodeLet>();
-                        letNode->identifier = consume(); // consume identifier
+                        Token identifier = consume(); // consume identifier
                         consume(); // consume '='
+                        _program.addName(identifier.symbol, identifier.value);
+                        NodeStatement letNode {.kind = StatementKind::LET, .line = identifier.line, .symbol = identifier.symbol};
                         if(auto nodeExp = parseExp()) {
-                            letNode->value = nodeExp.value();
+                            letNode.expression = nodeExp.value();
                         } else {
-                            cerr << "Failed to parse let value expression at line " << letToken.line << "." << endl;
-                            exit(EXIT_FAILURE);
+                            throw CompileError(letToken.line, "Failed to parse let value expression at line ", letToken.line, ".");
                         }
-                        auto statementNode = _allocator.allocate<NodeStatement>();
-                        statementNode->var = letNode;
-                        return statementNode;
+                        return _program.addStatement(letNode);
                     } else {
-                        cerr << "Invalid Syntax: Expected `=` after identifier at line " << identifierToken.line << "." << endl;
-                        exit(EXIT_FAILURE);
+                        throw CompileError(identifierToken.line, "Invalid Syntax: Expected `=` after identifier at line ", identifierToken.line, ".");
                     }
                 } else {
-                    cerr << "Invalid Syntax: Expected identifier after `let` at line " << letToken.line << "." << endl;
-                    exit(EXIT_FAILURE);
+                    throw CompileError(letToken.line, "Invalid Syntax: Expected identifier after `let` at line ", letToken.line, ".");
                 }
             } else if(peek().has_value() && peek().value().type == TokenType::IDENTIFIER) {
                 if(peek(1).has_value() && peek(1).value().type == TokenType::EQUALS) {
-                    auto assignmentNode = _allocator.allocate<NodeAssignment>();
-                    assignmentNode->identifier = consume(); // consume identifier
+                    Token identifier = consume(); // consume identifier
                     consume(); // consume '='
+                    _program.addName(identifier.symbol, identifier.value);
+                    NodeStatement assignmentNode {.kind = StatementKind::ASSIGNMENT, .line = identifier.line, .symbol = identifier.symbol};
                     if(auto expression = parseExp()) {
-                        assignmentNode->value = expression.value();
-                        auto statementNode = _allocator.allocate<NodeStatement>();
-                        statementNode->var = assignmentNode;
-                        return statementNode;
+                        assignmentNode.expression = expression.value();
+                        return _program.addStatement(assignmentNode);
                     } else {
-                        cerr << "Failed to parse assignment expression at line " << assignmentNode->identifier.line << "." << endl;
-                        exit(EXIT_FAILURE);
+                        throw CompileError(identifier.line, "Failed to parse assignment expression at line ", identifier.line, ".");
                     }
                 } else {
-                    cerr << "Invalid Syntax: Unexpected token `" << peek().value().value << "` at line " << peek().value().line << "." << endl;
-                    exit(EXIT_FAILURE);
+                    throw CompileError(peek().value().line, "Invalid Syntax: Unexpected token `", peek().value().value, "` at line ", peek().value().line, ".");
                 }
             } else if(auto _if = tryConsume(TokenType::IF)) {
-                tryConsume(TokenType::PAR_OPEN, "Invalid Syntax: Expected `(` after `if` at line " + to_string(_if->line) + ".");
-                auto ifStatement = _allocator.allocate<NodeIf>();
-                if(auto condition = parseExp()) ifStatement->condition = condition.value();
+                tryConsume(TokenType::PAR_OPEN, _if->line, "Invalid Syntax: Expected `(` after `if` at line " + to_string(_if->line) + ".");
+                NodeStatement ifStatement {.kind = StatementKind::IF, .line = _if->line};
+                if(auto condition = parseExp()) ifStatement.expression = condition.value();
                 else {
-                    cerr << "Failed to parse if condition at line " << _if->line << "." << endl;
-                    exit(EXIT_FAILURE);
+                    throw CompileError(_if->line, "Failed to parse if condition at line ", _if->line, ".");
                 }
-                tryConsume(TokenType::PAR_CLOSE, "Invalid Syntax: Expected `)` after if condition at line " + to_string(_if->line) + ".");
-                if(auto scopeNode = parseScope()) ifStatement->scope = scopeNode.value();
+                tryConsume(TokenType::PAR_CLOSE, _if->line, "Invalid Syntax: Expected `)` after if condition at line " + to_string(_if->line) + ".");
+                if(auto scopeNode = parseScope()) ifStatement.scope = scopeNode.value();
                 else {
-                    cerr << "Failed to parse if scope at line " << _if->line << "." << endl;
-                    exit(EXIT_FAILURE);
+                    throw CompileError(_if->line, "Failed to parse if scope at line ", _if->line, ".");
                 }
-                auto statementNode = _allocator.allocate<NodeStatement>();
-                statementNode->var = ifStatement;
-                return statementNode;
+                return _program.addStatement(ifStatement);
+            } else if(auto _while = tryConsume(TokenType::WHILE)) {
+                tryConsume(TokenType::PAR_OPEN, _while->line, "Invalid Syntax: Expected `(` after `while` at line " + to_string(_while->line) + ".");
+                NodeStatement whileStatement {.kind = StatementKind::WHILE, .line = _while->line};
+                if(auto condition = parseExp()) whileStatement.expression = condition.value();
+                else {
+                    throw CompileError(_while->line, "Failed to parse while condition at line ", _while->line, ".");
+                }
+                tryConsume(TokenType::PAR_CLOSE, _while->line, "Invalid Syntax: Expected `)` after while condition at line " + to_string(_while->line) + ".");
+                if(auto scopeNode = parseScope()) whileStatement.scope = scopeNode.value();
+                else {
+                    throw CompileError(_while->line, "Failed to parse while scope at line ", _while->line, ".");
+                }
+                return _program.addStatement(whileStatement);
+            } else if(auto fn = tryConsume(TokenType::FN)) {
+                if(_depth > 0) throw CompileError(fn->line, "Invalid Syntax: Functions can only be defined at the top level, at line ", fn->line, ".");
+                Token name = tryConsume(TokenType::IDENTIFIER, fn->line, "Invalid Syntax: Expected a name after `fn` at line " + to_string(fn->line) + ".");
+                _program.addName(name.symbol, name.value);
+                tryConsume(TokenType::PAR_OPEN, fn->line, "Invalid Syntax: Expected `(` after the name of `" + string(name.value) + "` at line " + to_string(fn->line) + ".");
+                vector<uint32_t> parameters;
+                if(!tryConsume(TokenType::PAR_CLOSE)) {
+                    do {
+                        Token parameter = tryConsume(TokenType::IDENTIFIER, fn->line, "Invalid Syntax: Expected a parameter name at line " + to_string(fn->line) + ".");
+                        _program.addName(parameter.symbol, parameter.value);
+                        parameters.push_back(parameter.symbol);
+                    } while(tryConsume(TokenType::COMMA));
+                    tryConsume(TokenType::PAR_CLOSE, fn->line, "Invalid Syntax: Expected `)` after the parameters of `" + string(name.value) + "` at line " + to_string(fn->line) + ".");
+                }
+                if(parameters.size() > 6) { // all of them are passed in registers
+                    throw CompileError(fn->line, "Invalid Syntax: Functions take at most 6 parameters, `", name.value, "` has ", parameters.size(), " at line ", fn->line, ".");
+                }
+                _inFunction = true;
+                optional<NodeIndex> body = parseScope();
+                _inFunction = false;
+                if(!body.has_value()) {
+                    throw CompileError(fn->line, "Invalid Syntax: Expected `{` after the parameters of `", name.value, "` at line ", fn->line, ".");
+                }
+                return _program.addStatement({.kind = StatementKind::FUNCTION, .line = fn->line, .symbol = name.symbol, .scope = body.value(), .function = _program.addFunction(parameters)});
+            } else if(auto _return = tryConsume(TokenType::RETURN)) {
+                if(!_inFunction) throw CompileError(_return->line, "Invalid Syntax: `return` outside of a function at line ", _return->line, ".");
+                NodeStatement returnStatement {.kind = StatementKind::RETURN, .line = _return->line};
+                if(auto value = parseExp()) returnStatement.expression = value.value();
+                else {
+                    throw CompileError(_return->line, "Failed to parse return expression at line ", _return->line, ".");
+                }
+                return _program.addStatement(returnStatement);
             } else if(auto _else = tryConsume(TokenType::ELSE)) {
                 if(peek().has_value() && peek().value().type == TokenType::CUR_OPEN) {
-                    auto elseNode = _allocator.allocate<NodeElse>();
                     if(auto scopeNode = parseScope()) {
-                        elseNode->scope = scopeNode.value();
-                        auto statementNode = _allocator.allocate<NodeStatement>();
-                        statementNode->var = elseNode;
-                        return statementNode;
+                        return _program.addStatement({.kind = StatementKind::ELSE, .line = _else->line, .scope = scopeNode.value()});
                     } else {
-                        cerr << "Failed to parse else scope at line " << _else->line << "." << endl;
-                        exit(EXIT_FAILURE);
+                        throw CompileError(_else->line, "Failed to parse else scope at line ", _else->line, ".");
                     }
                 } else {
-                    cerr << "Invalid Syntax: Expected `{` after `else` at line " << _else->line << "." << endl;
-                    exit(EXIT_FAILURE);
+                    throw CompileError(_else->line, "Invalid Syntax: Expected `{` after `else` at line ", _else->line, ".");
                 }
             } else if(peek().has_value() && peek().value().type == TokenType::CUR_OPEN) {
+                int line = peek().value().line;
                 if(auto scopeNode = parseScope()) {
-                    auto statementNode = _allocator.allocate<NodeStatement>();
-                    statementNode->var = scopeNode.value();
-                    return statementNode;
+                    return _program.addStatement({.kind = StatementKind::SCOPE, .line = line, .scope = scopeNode.value()});
                 } else {
-                    cerr << "Failed to parse scope at line " << peek().value().line << "." << endl;
-                    exit(EXIT_FAILURE);
+                    throw CompileError(line, "Failed to parse scope at line ", line, ".");
                 }
             } else {
-                if(peek().has_value()) {
-                    cerr << "Invalid Syntax: Unexpected token `" << peek().value().value << "` at line " << peek().value().line << "." << endl;
-                } else {
-                    cerr << "Invalid Syntax: Unexpected end of input at line " << _tokens.back().line << "." << endl;
-                }
-                exit(EXIT_FAILURE);
+                if(peek().has_value()) throw CompileError(peek().value().line, "Invalid Syntax: Unexpected token `", peek().value().value, "` at line ", peek().value().line, ".");
+                throw CompileError(_lastLine, "Invalid Syntax: Unexpected end of input at line ", _lastLine, ".");
             }
         }
 
-        optional<NodeProgram> parse() {
-            NodeProgram program;
-            while(peek().has_value()) {
-                if(auto nodeStatement = parseStatement()) {
-                    program.statements.push_back(nodeStatement.value());
-                } else {
-                    cerr << "Failed to parse statement at line " << _tokens.back().line << "." << endl;
-                    exit(EXIT_FAILURE);
-                }
+        // The deepest lookahead is `let identifier =`, three tokens, the ring is rounded up to a power of two.
+        static constexpr size_t lookahead = 4;
+
+        Tokenizer& _tokenizer;
+        array<Token, lookahead> _ring {};
+        size_t _head = 0; // ring slot of the current token
+        size_t _buffered = 0;
+        bool _exhausted = false;
+        int _lastLine = 0; // line of the last consumed token, for errors at the end of input
+        uint32_t _lastEnd = 0; // where the last consumed token ends
+        NodeProgram _program {};
+        vector<NodeIndex> _pending {}; // statements of the scopes that are still open, innermost last
+        int _depth = 0; // scopes open around the current statement
+        bool _inFunction = false;
+        ScopeReuse _reuse {};
+
+        // The arguments of a call, after `name(`.
+        NodeIndex parseCall(const Token& name) {
+            vector<NodeIndex> arguments; // a local list, arguments can hold calls themselves
+            if(!tryConsume(TokenType::PAR_CLOSE)) {
+                do {
+                    optional<NodeIndex> argument = parseExp();
+                    if(!argument.has_value()) {
+                        throw CompileError(name.line, "Failed to parse an argument of `", name.value, "` at line ", name.line, ".");
+                    }
+                    arguments.push_back(argument.value());
+                } while(tryConsume(TokenType::COMMA));
+                tryConsume(TokenType::PAR_CLOSE, name.line, "Invalid Syntax: Expected `)` after the arguments of `" + string(name.value) + "` at line " + to_string(name.line) + ".");
             }
-            return program;
+            _program.addName(name.symbol, name.value);
+            return _program.addCall(name.symbol, arguments, name.line);
         }
 
-    private:
-        const vector<Token> _tokens;
-        size_t _index = 0;
-        Allocator _allocator;
+        NodeIndex closeScope(size_t mark, SourceSpan source, int line = 0, int lastLine = 0) {
+            NodeIndex scope = _program.addScope(span<const NodeIndex>(_pending).subspan(mark), source, line, lastLine);
+            _pending.resize(mark);
+            return scope;
+        }
 
-        [[nodiscard]] inline optional<Token> peek(int num = 0) const {
-            if(_index + num >= _tokens.size()) return {};
-            else return _tokens.at(_index + num);
+        // Pulls tokens until `count` are buffered or the source ends.
+        inline void fill(size_t count) {
+            while(_buffered < count && !_exhausted) {
+                if(optional<Token> token = _tokenizer.next()) _ring[(_head + _buffered++) % lookahead] = token.value();
+                else _exhausted = true;
+            }
+        }
+
+        [[nodiscard]] inline optional<Token> peek(int num = 0) {
+            fill(num + 1);
+            if(static_cast<size_t>(num) >= _buffered) return {};
+            return _ring[(_head + num) % lookahead];
         }
 
-        inline Token consume() { return _tokens.at(_index++); }
+        // Continues after `end`, on `line`, dropping the tokens buffered before it.
+        inline void skipTo(uint32_t end, int line) {
+            _tokenizer.seek(end, line);
+            _buffered = 0;
+            _exhausted = false;
+            _lastEnd = end;
+            _lastLine = line;
+        }
+
+        inline Token consume() {
+            fill(1);
+            Token token = _ring[_head];
+            _head = (_head + 1) % lookahead;
+            _buffered--;
+            _lastLine = token.line;
+            _lastEnd = token.end();
+            return token;
+        }
 
-        inline Token tryConsume(TokenType type, string error) {
+        inline Token tryConsume(TokenType type, int line, const string& error) {
             if(peek().has_value() && peek().value().type == type) return consume();
-            cerr << error << endl;
-            exit(EXIT_FAILURE);
+            throw CompileError(line, error);
         }
 
         inline optional<Token> tryConsume(TokenType type) {
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include "instructions.hpp"
+
+using namespace std;
+
+// Rewrites short windows of the generated instructions into cheaper equivalents until nothing changes.
+class Peephole {
+    public:
+        inline explicit Peephole(vector<Instruction>& instructions): _instructions(instructions) { }
+
+        // Returns the number of rewrites applied.
+        size_t run() {
+            bool changed = true;
+            while(changed) {
+                changed = false;
+                vector<Instruction> result;
+                result.reserve(_instructions.size());
+                for(size_t i = 0; i < _instructions.size(); i++) {
+                    size_t consumed = rewrite(i, result);
+                    if(consumed == 0) {
+                        result.push_back(move(_instructions[i]));
+                    } else {
+                        i += consumed - 1;
+                        _rewrites++;
+                        changed = true;
+                    }
+                }
+                _instructions = move(result);
+            }
+            return _rewrites;
+        }
+
+        [[nodiscard]] size_t rewrites() const { return _rewrites; }
+
+    private:
+        vector<Instruction>& _instructions;
+        size_t _rewrites = 0;
+
+        static bool fitsImm32(uint64_t value) {
+            int64_t signedValue = static_cast<int64_t>(value);
+            return signedValue >= INT32_MIN && signedValue <= INT32_MAX;
+        }
+
+        static bool isRegister(const Operand& operand, optional<Register> reg = {}) {
+            auto value = get_if<Register>(&operand);
+            return value != nullptr && (!reg.has_value() || *value == reg.value());
+        }
+
+        static bool mentions(const Operand& operand, Register reg) {
+            if(auto memory = get_if<Memory>(&operand)) return memory->base == reg || memory->index == reg;
+            return isRegister(operand, reg);
+        }
+
+        static bool reads(const Instruction& instruction, Register reg) {
+            switch(instruction.opcode) {
+                case Opcode::SYSCALL:
+                    return reg == Register::RAX || reg == Register::RDI || reg == Register::RSI || reg == Register::RDX
+                        || reg == Register::R10 || reg == Register::R8 || reg == Register::R9;
+                case Opcode::DIV:
+                    return reg == Register::RAX || reg == Register::RDX || mentions(instruction.operands.at(0), reg);
+                case Opcode::MUL:
+                    return reg == Register::RAX || mentions(instruction.operands.at(0), reg);
+                case Opcode::XOR:
+                    if(instruction.operands.at(0) == instruction.operands.at(1)) return false;
+                    break;
+                case Opcode::MOV:
+                case Opcode::LEA:
+                case Opcode::POP: {
+                    // the destination register is only written, a memory destination reads its base
+                    const Operand& destination = instruction.operands.at(0);
+                    if(holds_alternative<Memory>(destination) && mentions(destination, reg)) return true;
+                    return instruction.opcode != Opcode::POP && mentions(instruction.operands.at(1), reg);
+                }
+                default:
+                    break;
+            }
+            for(const Operand& operand : instruction.operands) {
+                if(mentions(operand, reg)) return true;
+            }
+            return false;
+        }
+
+        static bool writes(const Instruction& instruction, Register reg) {
+            if(instruction.opcode == Opcode::MOV || instruction.opcode == Opcode::POP || instruction.opcode == Opcode::XOR || instruction.opcode == Opcode::LEA) return isRegister(instruction.operands.at(0), reg);
+            if(instruction.opcode == Opcode::MUL || instruction.opcode == Opcode::DIV) return reg == Register::RAX || reg == Register::RDX;
+            if(instruction.opcode == Opcode::SYSCALL) return reg == Register::RCX || reg == Register::R11; // clobbered by the kernel
+            return false;
+        }
+
+        // Scans forward from the instruction at `index` to see whether `reg` is overwritten before it is read again.
+        // Control flow ends the scan and is treated conservatively as a use, a call as well since it reads its arguments.
+        bool isDeadAfter(size_t index, Register reg) const {
+            for(size_t i = index + 1; i < _instructions.size(); i++) {
+                const Instruction& instruction = _instructions[i];
+                if(instruction.opcode == Opcode::LABEL || instruction.opcode == Opcode::JE || instruction.opcode == Opcode::JNE || instruction.opcode == Opcode::JMP || instruction.opcode == Opcode::CALL) return false;
+                if(instruction.opcode == Opcode::RET) return reg != Register::RAX && reg != Register::RSP; // only the return value survives
+                if(reads(instruction, reg)) return false;
+                if(writes(instruction, reg)) return true;
+            }
+            return true; // nothing runs after the end of the program
+        }
+
+        // Tries every pattern at `index`, appends the replacement and returns the number of instructions it replaces.
+        size_t rewrite(size_t index, vector<Instruction>& result) const {
+            const Instruction& current = _instructions[index];
+            const Instruction* next = index + 1 < _instructions.size() ? &_instructions[index + 1] : nullptr;
+
+            // add/sub rsp, 0 left behind by scopes without variables
+            if((current.opcode == Opcode::ADD || current.opcode == Opcode::SUB) && isRegister(current.operands.at(0), Register::RSP)) {
+                if(auto immediate = get_if<Immediate>(&current.operands.at(1)); immediate != nullptr && immediate->value == 0) return 1;
+            }
+
+            // mov reg, reg
+            if(current.opcode == Opcode::MOV && isRegister(current.operands.at(0)) && current.operands.at(0) == current.operands.at(1)) return 1;
+
+            if(next == nullptr) return 0;
+
+            // jmp label directly followed by that label
+            if(current.opcode == Opcode::JMP && next->opcode == Opcode::LABEL && current.operands.at(0) == next->operands.at(0)) return 1;
+
+            // push x, pop reg => mov reg, x
+            if(current.opcode == Opcode::PUSH && next->opcode == Opcode::POP && isRegister(next->operands.at(0))) {
+                if(current.operands.at(0) != next->operands.at(0)) {
+                    result.push_back({.opcode = Opcode::MOV, .operands = { next->operands.at(0), current.operands.at(0) }});
+                }
+                return 2;
+            }
+
+            if(current.opcode != Opcode::MOV || !isRegister(current.operands.at(0))) return 0;
+            Register temp = get<Register>(current.operands.at(0));
+            const Operand& source = current.operands.at(1);
+            auto immediate = get_if<Immediate>(&source);
+            bool smallImmediate = immediate != nullptr && fitsImm32(immediate->value);
+
+            // mov reg, imm; push reg => push imm
+            if(next->opcode == Opcode::PUSH && isRegister(next->operands.at(0), temp) && smallImmediate && isDeadAfter(index + 1, temp)) {
+                result.push_back({.opcode = Opcode::PUSH, .operands = { source }});
+                return 2;
+            }
+
+            // mov reg, x; mov y, reg => mov y, x
+            if(next->opcode == Opcode::MOV && isRegister(next->operands.at(1), temp) && !(next->operands.at(0) == current.operands.at(0)) && isDeadAfter(index + 1, temp)) {
+                bool destinationIsMemory = holds_alternative<Memory>(next->operands.at(0));
+                bool sourceIsMemory = holds_alternative<Memory>(source);
+                bool usesTemp = holds_alternative<Memory>(next->operands.at(0)) && mentions(next->operands.at(0), temp);
+                if(!usesTemp && !(destinationIsMemory && sourceIsMemory) && (!destinationIsMemory || immediate == nullptr || smallImmediate)) {
+                    result.push_back({.opcode = Opcode::MOV, .operands = { next->operands.at(0), source }});
+                    return 2;
+                }
+            }
+
+            // mov reg, imm; add/sub/cmp x, reg => add/sub/cmp x, imm
+            bool arithmetic = next->opcode == Opcode::ADD || next->opcode == Opcode::SUB || next->opcode == Opcode::CMP;
+            if(arithmetic && smallImmediate && isRegister(next->operands.at(1), temp) && !isRegister(next->operands.at(0), temp) && isDeadAfter(index + 1, temp)) {
+                result.push_back({.opcode = next->opcode, .operands = { next->operands.at(0), source }});
+                return 2;
+            }
+
+            return 0;
+        }
+};
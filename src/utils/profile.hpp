@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <cstring>
+#include <optional>
+#include <filesystem>
+#include <unordered_map>
+#include "ast.hpp"
+
+using namespace std;
+
+// Branch profiles behind --instrument and --profile-use. An instrumented program counts for every if how often it
+// is reached and how often its scope runs, for every while how often it is entered and how often its body runs.
+// The counters live in one block that the program writes out as it is when it exits, all 64 bit little endian:
+//   "EKOPROF1", hash of the source, number of branches, then per branch its source offset, reached and taken.
+// Branches are identified by the byte offset of their statement, so a profile only fits the source it was recorded
+// from. The hash is 0 when that source was not known.
+
+struct BranchCounts {
+    uint64_t reached = 0;
+    uint64_t taken = 0;
+};
+
+// 64 bit FNV-1a.
+inline uint64_t sourceHash(string_view source) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(unsigned char c : source) hash = (hash ^ c) * 0x100000001b3ULL;
+    return hash;
+}
+
+// The counter block of an instrumented compile. It has room for every if and while of the program, the path the
+// program writes the profile to follows the counters.
+class Instrumentation {
+    public:
+        static constexpr char magic[8] = { 'E', 'K', 'O', 'P', 'R', 'O', 'F', '1' };
+        static constexpr size_t headerSize = 24, recordSize = 24;
+
+        // `address` is where the executable maps the block, without it the program runs in process and counts
+        // straight into the block, which then has to outlive the code.
+        Instrumentation(const NodeProgram& program, uint64_t hash, const filesystem::path& path, optional<uint64_t> address = {}): _path(path) {
+            for(const NodeStatement& statement : program.statements) {
+                if(statement.kind == StatementKind::IF || statement.kind == StatementKind::WHILE) _capacity++;
+            }
+            string name = path.string();
+            _block.assign(headerSize + _capacity * recordSize + name.size() + 1, 0);
+            memcpy(_block.data(), magic, sizeof(magic));
+            memcpy(_block.data() + 8, &hash, 8);
+            memcpy(_block.data() + headerSize + _capacity * recordSize, name.c_str(), name.size() + 1);
+            _address = address.value_or(reinterpret_cast<uint64_t>(_block.data()));
+        }
+
+        // Adds the branch of the statement at `offset` and returns its index.
+        size_t addBranch(uint32_t offset) {
+            uint64_t record = offset;
+            memcpy(_block.data() + headerSize + _count * recordSize, &record, 8);
+            _count++;
+            memcpy(_block.data() + 16, &_count, 8);
+            return _count - 1;
+        }
+
+        [[nodiscard]] inline uint64_t reachedAddress(size_t branch) const { return _address + headerSize + branch * recordSize + 8; }
+        [[nodiscard]] inline uint64_t takenAddress(size_t branch) const { return _address + headerSize + branch * recordSize + 16; }
+        [[nodiscard]] inline uint64_t pathAddress() const { return _address + headerSize + _capacity * recordSize; }
+        [[nodiscard]] inline uint64_t address() const { return _address; }
+        // Bytes the program writes, the header and the branches it has.
+        [[nodiscard]] inline uint64_t size() const { return headerSize + _count * recordSize; }
+        [[nodiscard]] inline size_t branches() const { return _count; }
+        [[nodiscard]] inline const vector<uint8_t>& block() const { return _block; }
+
+        // Writes the profile of an in-process run, returns false if the file could not be written.
+        bool write() const {
+            ofstream output(_path, ios::binary | ios::trunc);
+            output.write(reinterpret_cast<const char*>(_block.data()), static_cast<streamsize>(size()));
+            return static_cast<bool>(output);
+        }
+
+    private:
+        filesystem::path _path;
+        vector<uint8_t> _block {};
+        uint64_t _address = 0;
+        size_t _capacity = 0;
+        uint64_t _count = 0;
+};
+
+// The counts of a profile, by the source offset of their branch.
+class Profile {
+    public:
+        // Nothing if the file cannot be read or is not a profile.
+        static optional<Profile> read(const filesystem::path& path) {
+            ifstream input(path, ios::binary);
+            string bytes((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+            if(!input.eof()) return {};
+            return parse(bytes);
+        }
+
+        static optional<Profile> parse(string_view bytes) {
+            if(bytes.size() < Instrumentation::headerSize || memcmp(bytes.data(), Instrumentation::magic, sizeof(Instrumentation::magic)) != 0) return {};
+            Profile profile;
+            uint64_t count;
+            memcpy(&profile._hash, bytes.data() + 8, 8);
+            memcpy(&count, bytes.data() + 16, 8);
+            if(count > (bytes.size() - Instrumentation::headerSize) / Instrumentation::recordSize) return {};
+            for(uint64_t i = 0; i < count; i++) {
+                uint64_t record[3];
+                memcpy(record, bytes.data() + Instrumentation::headerSize + i * Instrumentation::recordSize, sizeof(record));
+                profile._branches[static_cast<uint32_t>(record[0])] = { .reached = record[1], .taken = record[2] };
+            }
+            return profile;
+        }
+
+        [[nodiscard]] inline bool matches(uint64_t hash) const { return _hash == 0 || hash == 0 || _hash == hash; }
+
+        // The counts of the branch whose statement starts at `offset`, null if the profile has none.
+        [[nodiscard]] inline const BranchCounts* find(uint32_t offset) const {
+            auto it = _branches.find(offset);
+            return it == _branches.end() ? nullptr : &it->second;
+        }
+
+    private:
+        uint64_t _hash = 0;
+        unordered_map<uint32_t, BranchCounts> _branches {};
+};
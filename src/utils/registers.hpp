@@ -0,0 +1,108 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <optional>
+#include "instructions.hpp"
+#include "diagnostics.hpp"
+
+using namespace std;
+
+// Linear scan allocation of expression temporaries onto the general purpose registers.
+// Temporaries of an expression tree live in strict LIFO order, so the live interval that ends
+// furthest away is always the oldest one: that is the one that gets spilled to the stack under pressure.
+class RegisterAllocator {
+    public:
+        using Temp = size_t;
+
+        inline RegisterAllocator(vector<Register> pool, function<void(Register)> spill, function<void(Register)> reload)
+            : _pool(move(pool)), _spill(move(spill)), _reload(move(reload)) {
+            for(size_t i = _pool.size(); i > 0; i--) _free.push_back(i - 1);
+        }
+
+        // Allocates a new temporary in a register, spilling the oldest live temporary if none is free.
+        inline Temp allocate() {
+            if(_free.empty()) spillOldest();
+            size_t reg = _free.back();
+            _free.pop_back();
+            _temps.push_back({.reg = reg, .spilled = false, .live = true});
+            return _temps.size() - 1;
+        }
+
+        // Returns the register holding the temporary, reloading it from the stack if it was spilled.
+        inline Register ensure(Temp temp) {
+            Entry& entry = _temps.at(temp);
+            if(entry.spilled) {
+                if(_free.empty()) spillOldest();
+                entry.reg = _free.back();
+                _free.pop_back();
+                entry.spilled = false;
+                _reload(_pool.at(entry.reg));
+            }
+            return _pool.at(entry.reg);
+        }
+
+        // Takes a register out of the pool for a value that outlives single expressions, as long as `keep` registers
+        // stay free for temporaries. Only used between statements, when no temporary is live.
+        inline optional<Register> reserve(size_t keep) {
+            if(_free.size() <= keep) return {};
+            size_t reg = _free.front(); // the end of the pool, temporaries are handed out from its start
+            _free.erase(_free.begin());
+            return _pool.at(reg);
+        }
+
+        // Returns a reserved register to the pool, in the reverse order of reserving them.
+        inline void unreserve(Register reg) {
+            _free.insert(_free.begin(), static_cast<size_t>(find(_pool.begin(), _pool.end(), reg) - _pool.begin()));
+        }
+
+        inline void release(Temp temp) {
+            Entry& entry = _temps.at(temp);
+            if(!entry.spilled) _free.push_back(entry.reg);
+            entry.live = false;
+            while(!_temps.empty() && !_temps.back().live) _temps.pop_back();
+        }
+
+        // Spills every live temporary, before a call that may change any register.
+        inline void spillAll() {
+            for(Entry& entry : _temps) {
+                if(!entry.live || entry.spilled) continue;
+                _spill(_pool.at(entry.reg));
+                entry.spilled = true;
+                _free.push_back(entry.reg);
+            }
+        }
+
+        // The registers that are reserved or hold a temporary.
+        [[nodiscard]] inline vector<Register> occupied() const {
+            vector<Register> registers;
+            for(size_t reg = 0; reg < _pool.size(); reg++) {
+                if(ranges::find(_free, reg) == _free.end()) registers.push_back(_pool[reg]);
+            }
+            return registers;
+        }
+
+        [[nodiscard]] inline bool empty() const { return _temps.empty(); }
+
+    private:
+        struct Entry { size_t reg; bool spilled; bool live; };
+
+        vector<Register> _pool;
+        function<void(Register)> _spill;
+        function<void(Register)> _reload;
+        vector<size_t> _free {};
+        vector<Entry> _temps {};
+
+        void spillOldest() {
+            for(Entry& entry : _temps) {
+                if(!entry.live || entry.spilled) continue;
+                _spill(_pool.at(entry.reg));
+                entry.spilled = true;
+                _free.push_back(entry.reg);
+                return;
+            }
+            throw CompileError(0, "Internal Error: Ran out of registers while generating an expression.");
+        }
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <span>
+#include "ast.hpp"
+#include "symbols.hpp"
+#include "diagnostics.hpp"
+
+using namespace std;
+
+// Reports the errors the Generator would, without generating anything: names used before their `let` or outside
+// their scope, redeclarations, and calls of functions that do not exist or with the wrong number of arguments.
+// Function bodies are checked whether or not they are called.
+class NameResolver {
+    public:
+        inline explicit NameResolver(const NodeProgram& program): _program(program) { }
+
+        void run() {
+            for(NodeIndex index : _program.body(_program.root)) {
+                const NodeStatement& statement = _program.statement(index);
+                if(statement.kind != StatementKind::FUNCTION) continue;
+                if(statement.symbol >= _arity.size()) _arity.resize(statement.symbol + 1);
+                if(!_arity[statement.symbol].has_value()) _arity[statement.symbol] = _program.functions[statement.function].count;
+            }
+            resolve(_program.root);
+        }
+
+    private:
+        const NodeProgram& _program;
+        ScopedSymbolTable<bool> _declared {};
+        vector<optional<uint32_t>> _arity {}; // parameters by function name, of its first definition
+        vector<bool> _defined {}; // by symbol: a function of this name was resolved already
+
+        void resolveExpression(NodeIndex index) {
+            const NodeExpression& expression = _program.expression(index);
+            if(expression.kind == ExpressionKind::IDENTIFIER && _declared.find(expression.symbol) == nullptr) {
+                throw CompileError(expression.line, "Invalid Syntax: Identifier `", _program.name(expression.symbol), "` does not exist at line ", expression.line, ".");
+            }
+            if(expression.isBinary()) {
+                resolveExpression(expression.left());
+                resolveExpression(expression.right());
+            } else if(expression.kind == ExpressionKind::CALL) {
+                uint32_t callee = _program.callee(expression);
+                span<const NodeIndex> arguments = _program.argumentsOf(expression);
+                if(callee >= _arity.size() || !_arity[callee].has_value()) {
+                    throw CompileError(expression.line, "Invalid Syntax: Function `", _program.name(callee), "` does not exist at line ", expression.line, ".");
+                }
+                if(*_arity[callee] != arguments.size()) {
+                    throw CompileError(expression.line, "Invalid Syntax: Function `", _program.name(callee), "` takes ", *_arity[callee], " arguments but ", arguments.size(), " were given at line ", expression.line, ".");
+                }
+                for(NodeIndex argument : arguments) resolveExpression(argument);
+            }
+        }
+
+        // Same checks, in the same order, as the Generator.
+        void resolve(NodeIndex scope) {
+            for(NodeIndex index : _program.body(scope)) {
+                const NodeStatement& statement = _program.statement(index);
+                switch(statement.kind) {
+                    case StatementKind::LET:
+                        if(_declared.find(statement.symbol) != nullptr) {
+                            throw CompileError(statement.line, "Identifier `", _program.name(statement.symbol), "` already exists at line ", statement.line, ".");
+                        }
+                        resolveExpression(statement.expression);
+                        _declared.declare(statement.symbol, true);
+                        break;
+                    case StatementKind::ASSIGNMENT:
+                        if(_declared.find(statement.symbol) == nullptr) {
+                            throw CompileError(statement.line, "Identifier `", _program.name(statement.symbol), "` does not exist at line ", statement.line, "!");
+                        }
+                        resolveExpression(statement.expression);
+                        break;
+                    case StatementKind::EXIT:
+                    case StatementKind::RETURN:
+                        resolveExpression(statement.expression);
+                        break;
+                    case StatementKind::FUNCTION: {
+                        if(statement.symbol < _defined.size() && _defined[statement.symbol]) {
+                            throw CompileError(statement.line, "Function `", _program.name(statement.symbol), "` already exists at line ", statement.line, ".");
+                        }
+                        if(statement.symbol >= _defined.size()) _defined.resize(statement.symbol + 1);
+                        _defined[statement.symbol] = true;
+                        ScopedSymbolTable<bool> outer = exchange(_declared, {}); // the variables around it are not visible
+                        _declared.beginScope();
+                        for(uint32_t parameter : _program.parametersOf(statement)) {
+                            if(!_declared.declare(parameter, true)) {
+                                throw CompileError(statement.line, "Identifier `", _program.name(parameter), "` already exists at line ", statement.line, ".");
+                            }
+                        }
+                        resolve(statement.scope);
+                        _declared = move(outer);
+                        break;
+                    }
+                    case StatementKind::IF:
+                    case StatementKind::WHILE:
+                        resolveExpression(statement.expression);
+                        [[fallthrough]];
+                    case StatementKind::SCOPE:
+                    case StatementKind::ELSE:
+                        _declared.beginScope();
+                        resolve(statement.scope);
+                        _declared.endScope();
+                        break;
+                }
+            }
+        }
+};
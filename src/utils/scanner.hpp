@@ -0,0 +1,179 @@
+#pragma once
+
+#include <string_view>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define EKO_SCANNER_X86 1
+#endif
+
+using namespace std;
+
+enum class CharClass { WHITESPACE, ALNUM, DIGIT };
+
+// Bulk character scanning for the tokenizer. Runs of whitespace, identifier characters, digits and comment bodies
+// are classified 32 (AVX2) or 16 (SSE2) bytes at a time, the implementation is picked once at runtime
+// and falls back to a scalar loop on other architectures.
+class Scanner {
+    public:
+        // Returns the index of the first character at or after `index` that is not in the class.
+        static inline size_t skip(string_view src, size_t index, CharClass cls) {
+            if(index >= src.size()) return src.size();
+            return index + kernels().span(src.data() + index, src.size() - index, cls);
+        }
+
+        // Returns the index of the first `c` at or after `index`, or the length of the source.
+        static inline size_t find(string_view src, size_t index, char c) {
+            if(index >= src.size()) return src.size();
+            return index + kernels().find(src.data() + index, src.size() - index, c);
+        }
+
+        static inline size_t count(string_view src, size_t begin, size_t end, char c) {
+            if(begin >= end) return 0;
+            return kernels().count(src.data() + begin, end - begin, c);
+        }
+
+        [[nodiscard]] static inline const char* implementation() { return kernels().name; }
+
+    private:
+        struct Kernels {
+            const char* name;
+            size_t (*span)(const char*, size_t, CharClass);
+            size_t (*find)(const char*, size_t, char);
+            size_t (*count)(const char*, size_t, char);
+        };
+
+        static inline bool inClass(char c, CharClass cls) {
+            switch(cls) {
+                case CharClass::WHITESPACE: return c == ' ' || (c >= '\t' && c <= '\r');
+                case CharClass::ALNUM: return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+                case CharClass::DIGIT: return c >= '0' && c <= '9';
+            }
+            return false;
+        }
+
+        static size_t spanScalar(const char* data, size_t length, CharClass cls) {
+            size_t i = 0;
+            while(i < length && inClass(data[i], cls)) i++;
+            return i;
+        }
+
+        static size_t findScalar(const char* data, size_t length, char c) {
+            size_t i = 0;
+            while(i < length && data[i] != c) i++;
+            return i;
+        }
+
+        static size_t countScalar(const char* data, size_t length, char c) {
+            size_t result = 0;
+            for(size_t i = 0; i < length; i++) result += data[i] == c;
+            return result;
+        }
+
+#ifdef EKO_SCANNER_X86
+        // Bytes are compared as signed values, so everything above 0x7f falls outside of every class.
+        static inline __m128i range128(__m128i v, char low, char high) {
+            return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(low - 1)), _mm_cmpgt_epi8(_mm_set1_epi8(high + 1), v));
+        }
+
+        static inline uint32_t classMask128(const char* data, CharClass cls) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            __m128i mask;
+            switch(cls) {
+                case CharClass::WHITESPACE: mask = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), range128(v, '\t', '\r')); break;
+                case CharClass::ALNUM: mask = _mm_or_si128(range128(v, '0', '9'), _mm_or_si128(range128(v, 'A', 'Z'), range128(v, 'a', 'z'))); break;
+                default: mask = range128(v, '0', '9'); break;
+            }
+            return static_cast<uint32_t>(_mm_movemask_epi8(mask));
+        }
+
+        static size_t spanSse2(const char* data, size_t length, CharClass cls) {
+            size_t i = 0;
+            for(; i + 16 <= length; i += 16) {
+                uint32_t outside = ~classMask128(data + i, cls) & 0xFFFF;
+                if(outside != 0) return i + __builtin_ctz(outside);
+            }
+            return i + spanScalar(data + i, length - i, cls);
+        }
+
+        static size_t findSse2(const char* data, size_t length, char c) {
+            size_t i = 0;
+            __m128i needle = _mm_set1_epi8(c);
+            for(; i + 16 <= length; i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                uint32_t hits = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+                if(hits != 0) return i + __builtin_ctz(hits);
+            }
+            return i + findScalar(data + i, length - i, c);
+        }
+
+        static size_t countSse2(const char* data, size_t length, char c) {
+            size_t i = 0, result = 0;
+            __m128i needle = _mm_set1_epi8(c);
+            for(; i + 16 <= length; i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                result += __builtin_popcount(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle))));
+            }
+            return result + countScalar(data + i, length - i, c);
+        }
+
+        __attribute__((target("avx2"))) static inline __m256i range256(__m256i v, char low, char high) {
+            return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(low - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), v));
+        }
+
+        __attribute__((target("avx2"))) static inline uint32_t classMask256(const char* data, CharClass cls) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+            __m256i mask;
+            switch(cls) {
+                case CharClass::WHITESPACE: mask = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), range256(v, '\t', '\r')); break;
+                case CharClass::ALNUM: mask = _mm256_or_si256(range256(v, '0', '9'), _mm256_or_si256(range256(v, 'A', 'Z'), range256(v, 'a', 'z'))); break;
+                default: mask = range256(v, '0', '9'); break;
+            }
+            return static_cast<uint32_t>(_mm256_movemask_epi8(mask));
+        }
+
+        __attribute__((target("avx2"))) static size_t spanAvx2(const char* data, size_t length, CharClass cls) {
+            size_t i = 0;
+            for(; i + 32 <= length; i += 32) {
+                uint32_t outside = ~classMask256(data + i, cls);
+                if(outside != 0) return i + __builtin_ctz(outside);
+            }
+            return i + spanSse2(data + i, length - i, cls);
+        }
+
+        __attribute__((target("avx2"))) static size_t findAvx2(const char* data, size_t length, char c) {
+            size_t i = 0;
+            __m256i needle = _mm256_set1_epi8(c);
+            for(; i + 32 <= length; i += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                uint32_t hits = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+                if(hits != 0) return i + __builtin_ctz(hits);
+            }
+            return i + findSse2(data + i, length - i, c);
+        }
+
+        __attribute__((target("avx2,popcnt"))) static size_t countAvx2(const char* data, size_t length, char c) {
+            size_t i = 0, result = 0;
+            __m256i needle = _mm256_set1_epi8(c);
+            for(; i + 32 <= length; i += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                result += __builtin_popcount(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle))));
+            }
+            return result + countSse2(data + i, length - i, c);
+        }
+#endif
+
+        static const Kernels& kernels() {
+            static const Kernels selected = [] {
+#ifdef EKO_SCANNER_X86
+                __builtin_cpu_init();
+                if(__builtin_cpu_supports("avx2")) return Kernels{"avx2", spanAvx2, findAvx2, countAvx2};
+                return Kernels{"sse2", spanSse2, findSse2, countSse2};
+#else
+                return Kernels{"scalar", spanScalar, findScalar, countScalar};
+#endif
+            }();
+            return selected;
+        }
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Read-only view of a source file. Regular files are memory mapped, pipes and stdin (`-`) are read into a buffer.
+// A file that cannot be opened or read leaves the view empty and `failed()` set.
+class SourceFile {
+    public:
+        inline explicit SourceFile(const string& path) {
+            int fd = path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+            if(fd < 0) {
+                _failed = true;
+                return;
+            }
+
+            struct stat info {};
+            if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+                void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(mapping != MAP_FAILED) {
+                    madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+                    _mapping = mapping;
+                    _size = info.st_size;
+                }
+            }
+            if(_mapping == nullptr) readAll(fd);
+            if(fd != STDIN_FILENO) close(fd);
+        }
+
+        inline SourceFile(const SourceFile&) = delete;
+        inline SourceFile operator=(const SourceFile&) = delete;
+        inline ~SourceFile() { if(_mapping != nullptr) munmap(_mapping, _size); }
+
+        [[nodiscard]] inline bool failed() const { return _failed; }
+
+        [[nodiscard]] inline string_view view() const {
+            if(_mapping != nullptr) return { static_cast<const char*>(_mapping), _size };
+            return _buffer;
+        }
+
+    private:
+        void* _mapping = nullptr;
+        size_t _size = 0;
+        string _buffer {};
+        bool _failed = false;
+
+        void readAll(int fd) {
+            char chunk[1 << 16];
+            while(true) {
+                ssize_t count = read(fd, chunk, sizeof(chunk));
+                if(count < 0) {
+                    _failed = true;
+                    _buffer.clear();
+                    return;
+                }
+                if(count == 0) break;
+                _buffer.append(chunk, count);
+            }
+        }
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <sys/resource.h>
+#include "parser.hpp"
+
+using namespace std;
+
+// Pass timings and compile counters behind --time-passes and --stats, printed as text or as one JSON object per file.
+class CompileStatistics {
+    public:
+        enum class Format { TEXT, JSON };
+
+        // Adds the time between its construction and destruction to a pass.
+        class Timer {
+            public:
+                inline Timer(CompileStatistics& statistics, string pass): _statistics(statistics), _pass(move(pass)), _start(chrono::steady_clock::now()) { }
+                inline Timer(const Timer&) = delete;
+                inline Timer& operator=(const Timer&) = delete;
+                inline ~Timer() {
+                    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - _start;
+                    _statistics.addTime(_pass, elapsed.count());
+                }
+
+            private:
+                CompileStatistics& _statistics;
+                string _pass;
+                chrono::steady_clock::time_point _start;
+        };
+
+        [[nodiscard]] inline Timer time(string pass) { return Timer(*this, move(pass)); }
+
+        void addTime(const string& pass, double milliseconds) {
+            for(auto& [name, total] : _passes) {
+                if(name == pass) {
+                    total += milliseconds;
+                    return;
+                }
+            }
+            _passes.push_back({ pass, milliseconds });
+        }
+
+        void count(const string& counter, uint64_t value) {
+            for(auto& [name, total] : _counters) {
+                if(name == counter) {
+                    total += value;
+                    return;
+                }
+            }
+            _counters.push_back({ counter, value });
+        }
+
+        // Counts the AST nodes by kind, as `nodes.<kind>` counters, and the bytes the tree occupies.
+        void countNodes(const NodeProgram& program) {
+            static const char* expressionKinds[] = { "nodes.number", "nodes.identifier", "nodes.call", "nodes.add", "nodes.subtract", "nodes.multiply", "nodes.divide" };
+            static const char* statementKinds[] = { "nodes.exit", "nodes.let", "nodes.assignment", "nodes.return", "nodes.scope", "nodes.if", "nodes.else", "nodes.while", "nodes.fn" };
+            uint64_t expressions[size(expressionKinds)] = {}, statements[size(statementKinds)] = {};
+            for(const NodeExpression& expression : program.expressions) expressions[static_cast<size_t>(expression.kind)]++;
+            for(const NodeStatement& statement : program.statements) statements[static_cast<size_t>(statement.kind)]++;
+            for(size_t i = 0; i < size(statementKinds); i++) count(statementKinds[i], statements[i]);
+            for(size_t i = 0; i < size(expressionKinds); i++) count(expressionKinds[i], expressions[i]);
+            count("ast_bytes", program.bytes());
+        }
+
+        // ru_maxrss is process wide, in a batch compile it covers every file compiled so far.
+        static uint64_t peakResidentKiB() {
+            rusage usage {};
+            getrusage(RUSAGE_SELF, &usage);
+            return static_cast<uint64_t>(usage.ru_maxrss);
+        }
+
+        // Writes the report in one piece so reports of parallel compiles do not interleave.
+        void print(ostream& out, Format format, string_view file, bool timings, bool counters) const {
+            ostringstream report;
+            if(format == Format::JSON) {
+                report << "{\"file\":" << quoted(file);
+                if(timings) {
+                    report << ",\"passes\":{";
+                    for(size_t i = 0; i < _passes.size(); i++) report << (i ? "," : "") << quoted(_passes[i].first) << ":" << fixed << setprecision(3) << _passes[i].second;
+                    report << "},\"total_ms\":" << fixed << setprecision(3) << total();
+                }
+                if(counters) {
+                    report << ",\"counters\":{";
+                    for(size_t i = 0; i < _counters.size(); i++) report << (i ? "," : "") << quoted(_counters[i].first) << ":" << _counters[i].second;
+                    report << "},\"peak_rss_kib\":" << peakResidentKiB();
+                }
+                report << "}\n";
+            } else {
+                report << "=== " << file << " ===\n";
+                if(timings) {
+                    report << "Pass timings (ms):\n";
+                    for(const auto& [name, milliseconds] : _passes) report << "  " << left << setw(24) << name << right << setw(12) << fixed << setprecision(3) << milliseconds << "\n";
+                    report << "  " << left << setw(24) << "total" << right << setw(12) << fixed << setprecision(3) << total() << "\n";
+                }
+                if(counters) {
+                    report << "Statistics:\n";
+                    for(const auto& [name, value] : _counters) report << "  " << left << setw(24) << name << right << setw(12) << value << "\n";
+                    report << "  " << left << setw(24) << "peak_rss_kib" << right << setw(12) << peakResidentKiB() << "\n";
+                }
+            }
+            out << report.str() << flush;
+        }
+
+    private:
+        vector<pair<string, double>> _passes {};
+        vector<pair<string, uint64_t>> _counters {};
+
+        double total() const {
+            double sum = 0;
+            for(const auto& pass : _passes) sum += pass.second;
+            return sum;
+        }
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <unordered_map>
+
+using namespace std;
+
+// Interns identifier names so that the rest of the pipeline can compare them as integers.
+// The names are views into the source buffer, which has to outlive the table, unless the table owns copies.
+class SymbolTable {
+    public:
+        SymbolTable() = default;
+        // An owning table keeps copies of the names, for sources that change while the table is in use.
+        inline explicit SymbolTable(bool owning): _owning(owning) { }
+
+        inline uint32_t intern(string_view name) {
+            if(_owning) {
+                auto it = _ids.find(name);
+                if(it != _ids.end()) return it->second;
+                name = _copies.emplace_back(name);
+            }
+            auto [it, inserted] = _ids.try_emplace(name, static_cast<uint32_t>(_names.size()));
+            if(inserted) _names.push_back(name);
+            return it->second;
+        }
+
+        [[nodiscard]] inline string_view name(uint32_t symbol) const { return _names.at(symbol); }
+        [[nodiscard]] inline size_t size() const { return _names.size(); }
+
+    private:
+        unordered_map<string_view, uint32_t> _ids {};
+        vector<string_view> _names {};
+        bool _owning = false;
+        deque<string> _copies {}; // a deque never moves its strings, the views above stay valid
+};
+
+// Block scoped declarations keyed by interned symbol: O(1) lookup and declaration,
+// and popping a scope only touches the symbols it declared.
+template<typename T>
+class ScopedSymbolTable {
+    public:
+        [[nodiscard]] inline T* find(uint32_t symbol) {
+            if(symbol >= _entries.size() || !_entries[symbol].has_value()) return nullptr;
+            return &_entries[symbol].value();
+        }
+
+        // Returns false if the symbol is already declared in any enclosing scope.
+        inline bool declare(uint32_t symbol, T value) {
+            if(symbol >= _entries.size()) _entries.resize(symbol + 1);
+            if(_entries[symbol].has_value()) return false;
+            _entries[symbol] = move(value);
+            _declared.push_back(symbol);
+            return true;
+        }
+
+        inline void beginScope() { _scopes.push_back(_declared.size()); }
+
+        // Forgets the innermost scope's declarations and returns how many there were.
+        inline size_t endScope() {
+            size_t count = _declared.size() - _scopes.back();
+            for(size_t i = _scopes.back(); i < _declared.size(); i++) _entries[_declared[i]].reset();
+            _declared.resize(_scopes.back());
+            _scopes.pop_back();
+            return count;
+        }
+
+    private:
+        vector<optional<T>> _entries {};
+        vector<uint32_t> _declared {};
+        vector<size_t> _scopes {};
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+using namespace std;
+
+// Work stealing pool: every worker pops from the back of its own queue
+// and steals from the front of the others once its own queue runs dry.
+class ThreadPool {
+    public:
+        inline explicit ThreadPool(size_t threads) {
+            if(threads == 0) threads = 1;
+            for(size_t i = 0; i < threads; i++) _queues.push_back(make_unique<Queue>());
+            for(size_t i = 0; i < threads; i++) _workers.emplace_back([this, i] { work(i); });
+        }
+
+        inline ThreadPool(const ThreadPool&) = delete;
+        inline ThreadPool& operator=(const ThreadPool&) = delete;
+        inline ~ThreadPool() {
+            wait();
+            {
+                lock_guard<mutex> lock(_mutex);
+                _stopping = true;
+            }
+            _wakeup.notify_all();
+            for(thread& worker : _workers) worker.join();
+        }
+
+        // Tasks are dealt out round robin, stealing evens out the uneven ones.
+        void submit(function<void()> task) {
+            Queue& queue = *_queues[_next++ % _queues.size()];
+            {
+                lock_guard<mutex> lock(queue.lock);
+                queue.tasks.push_back(move(task));
+            }
+            {
+                lock_guard<mutex> lock(_mutex);
+                _pending++;
+                _queued++;
+            }
+            _wakeup.notify_one();
+        }
+
+        // Blocks until every submitted task has finished.
+        void wait() {
+            unique_lock<mutex> lock(_mutex);
+            _done.wait(lock, [this] { return _pending == 0; });
+        }
+
+    private:
+        struct Queue {
+            mutex lock;
+            deque<function<void()>> tasks;
+        };
+
+        vector<unique_ptr<Queue>> _queues {};
+        vector<thread> _workers {};
+        mutex _mutex;
+        condition_variable _wakeup;
+        condition_variable _done;
+        size_t _pending = 0; // submitted and not finished yet
+        size_t _queued = 0; // submitted and not taken by a worker yet
+        size_t _next = 0;
+        bool _stopping = false;
+
+        bool take(size_t index, function<void()>& task) {
+            Queue& own = *_queues[index];
+            {
+                lock_guard<mutex> lock(own.lock);
+                if(!own.tasks.empty()) {
+                    task = move(own.tasks.back());
+                    own.tasks.pop_back();
+                    return true;
+                }
+            }
+            for(size_t offset = 1; offset < _queues.size(); offset++) {
+                Queue& victim = *_queues[(index + offset) % _queues.size()];
+                lock_guard<mutex> lock(victim.lock);
+                if(!victim.tasks.empty()) {
+                    task = move(victim.tasks.front());
+                    victim.tasks.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void work(size_t index) {
+            while(true) {
+                function<void()> task;
+                if(take(index, task)) {
+                    {
+                        lock_guard<mutex> lock(_mutex);
+                        _queued--;
+                    }
+                    task();
+                    lock_guard<mutex> lock(_mutex);
+                    if(--_pending == 0) _done.notify_all();
+                    continue;
+                }
+                unique_lock<mutex> lock(_mutex);
+                if(_stopping) return;
+                _wakeup.wait(lock, [this] { return _stopping || _queued > 0; });
+                if(_stopping) return;
+            }
+        }
+};
@@ -3,17 +3,21 @@
 #include <iostream>
 #include <vector>
 #include <optional>
+#include <string_view>
 #include <unordered_map>
+#include "symbols.hpp"
+#include "scanner.hpp"
+#include "diagnostics.hpp"
 
 using namespace std;
 
 enum class TokenType {
-    EXIT, NUMBER, IDENTIFIER, LET, IF, ELSE,
+    EXIT, NUMBER, IDENTIFIER, LET, IF, ELSE, WHILE, FN, RETURN,
     EQUALS, PLUS, TIMES, MINUS, DIVIDE,
-    PAR_OPEN, PAR_CLOSE, CUR_OPEN, CUR_CLOSE
+    PAR_OPEN, PAR_CLOSE, CUR_OPEN, CUR_CLOSE, COMMA
 };
 
-optional<int> binaryPrecedence(TokenType type) {
+inline optional<int> binaryPrecedence(TokenType type) {
     switch(type) {
         case TokenType::PLUS:
         case TokenType::MINUS:
@@ -26,109 +30,150 @@ optional<int> binaryPrecedence(TokenType type) {
     }
 }
 
+// Tokens are views into the source buffer, identifiers additionally carry their interned symbol.
 struct Token {
     TokenType type;
-    string value;
+    string_view value;
     int line;
+    uint32_t symbol = 0;
+    uint32_t offset = 0; // the token spans the bytes [offset, offset + value.size()) of the source
+
+    [[nodiscard]] inline uint32_t end() const { return offset + static_cast<uint32_t>(value.size()); }
 };
 
+inline uint64_t parseNumber(string_view digits) {
+    uint64_t result = 0;
+    for(char c : digits) result = result * 10 + (c - '0'); // wraps around like the generated code does
+    return result;
+}
+
+// Produces tokens on demand, the parser pulls them one at a time so the whole token stream never has to exist at once.
 class Tokenizer {
     public:
-        inline explicit Tokenizer(const string& src): _src(src) { }
+        inline explicit Tokenizer(string_view src): _src(src) { }
 
-        inline vector<Token> tokenize() {
-            vector<Token> tokens;
-            string buffer;
-            int lineCount = 0;
+        // Starts at byte `offset`, on `line`, interning identifiers into a table that outlives the tokenizer.
+        inline Tokenizer(string_view src, SymbolTable& symbols, size_t offset, int line): _src(src), _index(offset), _line(line), _symbols(&symbols) { }
 
-            static const unordered_map<string, TokenType> keywords = {
+        // The next token, or nothing at the end of the source.
+        inline optional<Token> next() {
+            static const unordered_map<string_view, TokenType> keywords = {
                 { "exit", TokenType::EXIT },
                 { "let", TokenType::LET },
                 { "if", TokenType::IF },
                 { "else", TokenType::ELSE },
+                { "while", TokenType::WHILE },
+                { "fn", TokenType::FN },
+                { "return", TokenType::RETURN },
             };
 
-            static const unordered_map<string, TokenType> operators = {
-                { "=", TokenType::EQUALS },
-                { "+", TokenType::PLUS },
-                { "-", TokenType::MINUS },
-                { "*", TokenType::TIMES },
-                { "/", TokenType::DIVIDE },
-                { "(", TokenType::PAR_OPEN },
-                { ")", TokenType::PAR_CLOSE },
-                { "{", TokenType::CUR_OPEN },
-                { "}", TokenType::CUR_CLOSE }
+            static const unordered_map<char, TokenType> operators = {
+                { '=', TokenType::EQUALS },
+                { '+', TokenType::PLUS },
+                { '-', TokenType::MINUS },
+                { '*', TokenType::TIMES },
+                { '/', TokenType::DIVIDE },
+                { '(', TokenType::PAR_OPEN },
+                { ')', TokenType::PAR_CLOSE },
+                { '{', TokenType::CUR_OPEN },
+                { '}', TokenType::CUR_CLOSE },
+                { ',', TokenType::COMMA }
             };
 
-            while(peek().has_value()) {
+            while(_index < _src.length()) {
+                char current = _src[_index];
                 // If alphabetic character
-                if(isalpha(peek().value())) {
-                    buffer.push_back(consume());
-                    while(peek().has_value() && isalnum(peek().value())) buffer.push_back(consume());
-
-                    auto it = keywords.find(buffer);
-                    if(it != keywords.end()) tokens.push_back({.type = it->second, .value = buffer, .line = lineCount});
-                    else tokens.push_back({.type = TokenType::IDENTIFIER, .value = buffer, .line = lineCount});
-                    buffer.clear();
-                    continue;
+                if(isalpha(current)) {
+                    size_t start = _index;
+                    _index = Scanner::skip(_src, _index + 1, CharClass::ALNUM);
+                    string_view word = view(start);
+                    _count++;
+
+                    auto it = keywords.find(word);
+                    if(it != keywords.end()) return Token{.type = it->second, .value = word, .line = _line, .offset = static_cast<uint32_t>(start)};
+                    return Token{.type = TokenType::IDENTIFIER, .value = word, .line = _line, .symbol = _symbols->intern(word), .offset = static_cast<uint32_t>(start)};
                 }
                 // If digit
-                else if(isdigit(peek().value())) {
-                    buffer.push_back(consume());
-                    while(peek().has_value() && isdigit(peek().value())) buffer.push_back(consume());
-                    tokens.push_back({.type = TokenType::NUMBER, .value = buffer, .line = lineCount});
-                    buffer.clear();
-                    continue;
+                else if(isdigit(current)) {
+                    size_t start = _index;
+                    _index = Scanner::skip(_src, _index + 1, CharClass::DIGIT);
+                    _count++;
+                    return Token{.type = TokenType::NUMBER, .value = view(start), .line = _line, .offset = static_cast<uint32_t>(start)};
                 }
                 // If comment
-                else if(peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/') {
-                    consume(); consume();
-                    while(peek().has_value() && peek().value() != '\n') consume();
+                else if(current == '/' && peek(1) == '/') {
+                    _index = Scanner::find(_src, _index + 2, '\n');
                     continue;
-                } else if(peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*') {
-                    consume(); consume();
-                    while(peek().has_value()) {
-                        if(peek().value() == '*' && peek(1).has_value() && peek(1).value() == '/') break;
-                        if(peek().value() == '\n') lineCount++;
-                        consume();
+                } else if(current == '/' && peek(1) == '*') {
+                    size_t end = _index + 2;
+                    while(true) {
+                        end = Scanner::find(_src, end, '*');
+                        if(end + 1 >= _src.length()) {
+                            throw CompileError(_line, "Invalid Syntax: Unterminated comment starting at line ", _line, ".");
+                        }
+                        if(_src[end + 1] == '/') break;
+                        end++;
                     }
-                    lineCount++;
-                    consume(); consume();
+                    _line += Scanner::count(_src, _index + 2, end, '\n');
+                    _line++;
+                    _index = end + 2;
                     continue;
-                } 
+                }
                 // If newline or space
-                else if(peek().value() == '\n') {
-                    lineCount++;
-                    consume();
-                    continue;
-                } else if(isspace(peek().value())) {
-                    consume();
+                else if(isspace(current)) {
+                    size_t start = _index;
+                    _index = Scanner::skip(_src, _index + 1, CharClass::WHITESPACE);
+                    _line += Scanner::count(_src, start, _index, '\n');
                     continue;
                 }
                 // If special character
                 else {
-                    auto it = operators.find(string(1, peek().value()));
+                    auto it = operators.find(current);
                     if(it != operators.end()) {
-                        tokens.push_back({.type = it->second, .value = string(1, consume()), .line = lineCount});
-                        continue;
+                        _count++;
+                        size_t start = _index++;
+                        return Token{.type = it->second, .value = _src.substr(start, 1), .line = _line, .offset = static_cast<uint32_t>(start)};
                     } else {
-                        cerr << "Invalid Syntax: Unexpected character `" << peek().value() << "` at line " << lineCount << "." << endl;
-                        exit(EXIT_FAILURE);
+                        throw CompileError(_line, "Invalid Syntax: Unexpected character `", current, "` at line ", _line, ".");
                     }
                 }
             }
+            return {};
+        }
+
+        // Continues at byte `offset`, which has to lie between two tokens, on `line`.
+        inline void seek(size_t offset, int line) {
+            _index = offset;
+            _line = line;
+        }
+
+        // Tokenizes the whole source at once, for callers that want the complete stream.
+        inline vector<Token> tokenize() {
+            vector<Token> tokens;
+            while(optional<Token> token = next()) tokens.push_back(token.value());
             _index = 0;
+            _line = 0;
             return tokens;
         }
 
+        [[nodiscard]] inline const SymbolTable& symbols() const { return *_symbols; }
+        // Tokens produced so far.
+        [[nodiscard]] inline size_t count() const { return _count; }
+        [[nodiscard]] inline int line() const { return _line; }
+
     private:
-        const string _src;
+        const string_view _src; // not owned, the source has to outlive the tokens
         size_t _index = 0;
+        int _line = 0;
+        size_t _count = 0;
+        SymbolTable _ownSymbols {};
+        SymbolTable* _symbols = &_ownSymbols;
 
-        [[nodiscard]] inline optional<char> peek(int num = 0) const {
-            if(_index + num >= _src.length()) return {};
-            else return _src.at(_index + num);
+        [[nodiscard]] inline string_view view(size_t start) const {
+            return _src.substr(start, _index - start);
         }
 
-        inline char consume() { return _src.at(_index++); }
-};
\ No newline at end of file
+        [[nodiscard]] inline char peek(size_t num = 0) const {
+            return _index + num < _src.length() ? _src[_index + num] : '\0';
+        }
+};
@@ -0,0 +1,21 @@
+#!/bin/sh
+# A file that fails in a parallel batch fails on its own: the others are still written, every error names its file
+# and the batch exits with a failure.
+# Usage: batch_errors.sh <eko> <program> <other program> <bad program>
+eko=$1 good=$2 other=$3 bad=$4
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+fail() { echo "$1"; exit 1; }
+
+"$eko" -j 4 --out-dir "$out/bin" "$good" "$bad" "$out/missing.eko" 2> "$out/errors" && fail "the batch succeeded"
+cat "$out/errors"
+[ -x "$out/bin/$(basename "$good" .eko)" ] || fail "the good file was not written"
+grep -q "^$bad: Failed to parse" "$out/errors" || fail "the parse error does not name its file"
+grep -q "^$out/missing.eko: Failed to read the input file" "$out/errors" || fail "the read error does not name its file"
+
+# an output directory that cannot be created fails every file, without ending the batch early
+touch "$out/file"
+"$eko" -j 4 --out-dir "$out/file/bin" "$good" "$other" 2> "$out/errors" && fail "the unwritable batch succeeded"
+cat "$out/errors"
+[ "$(grep -c ": Failed to write the output file" "$out/errors")" = 2 ] || fail "not every file reported its output"
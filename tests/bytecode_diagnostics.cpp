@@ -0,0 +1,32 @@
+#include <iostream>
+#include "eko.hpp"
+#include "utils/bytecode.hpp"
+
+using namespace std;
+
+// Lowering an invalid program to bytecode reports a CompileError instead of ending the process. The programs are
+// not optimized, so the errors reach the bytecode compiler.
+static bool expectDiagnostic(string_view source, string_view message) {
+    Compiler compiler;
+    try {
+        BytecodeProgram bytecode = BytecodeCompiler(compiler.analyze(source, {.optimize = false})).compile();
+    } catch(const CompileError& error) {
+        if(error.diagnostic().message == message) return true;
+        cerr << "Expected `" << message << "` but got `" << error.diagnostic().message << "`." << endl;
+        return false;
+    }
+    cerr << "Expected `" << message << "` but the program compiled." << endl;
+    return false;
+}
+
+int main() {
+    bool passed = true;
+    passed &= expectDiagnostic("let a = 1\nexit(b)\n", "Invalid Syntax: Identifier `b` does not exist at line 1.");
+    passed &= expectDiagnostic("let a = 1\nlet a = 2\n", "Identifier `a` already exists at line 1.");
+    passed &= expectDiagnostic("b = 1\n", "Identifier `b` does not exist at line 0!");
+    passed &= expectDiagnostic("exit(f(1))\n", "Invalid Syntax: Function `f` does not exist at line 0.");
+    passed &= expectDiagnostic("fn f(a) { return a }\nexit(f(1, 2))\n", "Invalid Syntax: Function `f` takes 1 arguments but 2 were given at line 1.");
+    passed &= expectDiagnostic("fn f() { return 1 }\nfn f() { return 2 }\n", "Function `f` already exists at line 1.");
+    passed &= expectDiagnostic("fn f(a, a) { return a }\n", "Identifier `a` already exists at line 0.");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,30 @@
+#include <iostream>
+#include "eko.hpp"
+#include "utils/cache.hpp"
+
+using namespace std;
+
+// The cache key covers the source, the build of libeko, the flags and the profile, like the one eko --cache uses.
+// A change to any of them has to miss.
+static string key(string_view source, string_view build, string_view flags, string_view profile = "") {
+    return CompilationCache::key({ source, build, flags, profile });
+}
+
+static bool expect(bool condition, string_view message) {
+    if(!condition) cerr << message << endl;
+    return condition;
+}
+
+int main() {
+    string_view source = "let a = 6\nexit(a * 7)\n";
+    string base = key(source, buildId(), "OP");
+    bool passed = true;
+    passed &= expect(base == key(source, buildId(), "OP"), "The key of the same compile differs.");
+    passed &= expect(base != key(source, string(buildId()) + "x", "OP"), "Another build of libeko has the same key.");
+    passed &= expect(base != key(source, buildId(), "P"), "Other flags have the same key.");
+    passed &= expect(base != key(source, buildId(), "OPI"), "Other flags have the same key.");
+    passed &= expect(base != key("let a = 6\nexit(a * 8)\n", buildId(), "OP"), "Another source has the same key.");
+    passed &= expect(base != key(source, buildId(), "OP", "profile"), "Another profile has the same key.");
+    passed &= expect(key(source, "ab", "c") != key(source, "a", "bc"), "Moving the boundary between parts keeps the key.");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
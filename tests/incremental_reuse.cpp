@@ -0,0 +1,63 @@
+#include <iostream>
+#include <vector>
+#include "eko.hpp"
+
+using namespace std;
+
+// An edit inside one nested scope keeps the node indices of its unchanged siblings and moves those behind it.
+static const char* source =
+    "{\n"
+    "    let a = 1\n"
+    "    {\n"
+    "        let b = 2\n"
+    "    }\n"
+    "    {\n"
+    "        let c = 3\n"
+    "    }\n"
+    "    {\n"
+    "        let d = 4\n"
+    "    }\n"
+    "    exit(a)\n"
+    "}\n";
+
+// The scopes of the scope statements inside the top level scope.
+static vector<NodeIndex> innerScopes(const NodeProgram& program) {
+    vector<NodeIndex> scopes;
+    const NodeStatement& outer = program.statement(program.body(program.root)[0]);
+    for(NodeIndex index : program.body(outer.scope)) {
+        const NodeStatement& statement = program.statement(index);
+        if(statement.kind == StatementKind::SCOPE) scopes.push_back(statement.scope);
+    }
+    return scopes;
+}
+
+static bool check(bool condition, const char* message) {
+    if(!condition) cerr << message << endl;
+    return condition;
+}
+
+int main() {
+    IncrementalParser incremental(source);
+    vector<NodeIndex> before = innerScopes(incremental.program());
+
+    string edited = source;
+    size_t at = edited.find("3\n");
+    edited.replace(at, 1, "30\n       ");
+    incremental.edit(at, at + 1, "30\n       ");
+    vector<NodeIndex> after = innerScopes(incremental.program());
+
+    bool passed = check(before.size() == 3 && after.size() == 3, "Expected three inner scopes.");
+    passed = passed && check(after[0] == before[0] && after[2] == before[2], "The unchanged scopes were parsed again.");
+    passed = passed && check(after[1] != before[1], "The edited scope was not parsed again.");
+    passed = passed && check(incremental.reusedScopes() == 2, "Expected two reused scopes.");
+
+    // the kept scope behind the edit has moved with its text
+    const NodeProgram& program = incremental.program();
+    const NodeScope& moved = program.scopes[after[2]];
+    passed = passed && check(moved.span.begin == edited.find("{\n        let d"), "The span of the scope behind the edit did not move.");
+    passed = passed && check(moved.line == 9 && program.statement(program.body(after[2])[0]).line == 10, "The lines of the scope behind the edit did not move.");
+
+    Compiler incrementalCompiler, compiler;
+    passed = passed && check(incrementalCompiler.compile(program).code == compiler.compile(edited).code, "The edited tree compiles differently from the edited source.");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
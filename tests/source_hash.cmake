@@ -0,0 +1,34 @@
+# The build id hashes the contents of libeko's sources: the header of this build matches a hash of the checkout, a
+# copy of the sources hashes the same, and an edit to the copy changes the hash. Nothing in the checkout or the
+# build is modified.
+# Run with `cmake -DSCRIPT=<SourceHash.cmake> -DSOURCE_DIR=<src> -DBUILT=<generated header> -DWORK=<dir> -P source_hash.cmake`.
+function(hash directory output)
+    execute_process(COMMAND ${CMAKE_COMMAND} -DSOURCE_DIR=${directory} -DOUTPUT=${output} -P ${SCRIPT} RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Hashing `${directory}` failed.")
+    endif()
+endfunction()
+
+file(REMOVE_RECURSE "${WORK}")
+file(MAKE_DIRECTORY "${WORK}/src")
+hash("${SOURCE_DIR}" "${WORK}/checkout.hpp")
+file(READ "${WORK}/checkout.hpp" checkout)
+file(READ "${BUILT}" built)
+if(NOT checkout STREQUAL built)
+    message(FATAL_ERROR "The build id of this build is not the hash of its sources.")
+endif()
+
+file(COPY "${SOURCE_DIR}/eko.cpp" "${SOURCE_DIR}/eko.hpp" "${SOURCE_DIR}/utils" DESTINATION "${WORK}/src")
+hash("${WORK}/src" "${WORK}/copy.hpp")
+file(READ "${WORK}/copy.hpp" copy)
+if(NOT copy STREQUAL checkout)
+    message(FATAL_ERROR "A copy of the sources hashes differently.")
+endif()
+
+file(APPEND "${WORK}/src/utils/generator.hpp" "// edited\n")
+hash("${WORK}/src" "${WORK}/edited.hpp")
+file(READ "${WORK}/edited.hpp" edited)
+if(edited STREQUAL checkout)
+    message(FATAL_ERROR "Editing a pass did not change the hash.")
+endif()
+file(REMOVE_RECURSE "${WORK}")